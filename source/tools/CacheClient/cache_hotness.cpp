@@ -0,0 +1,303 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+//  This tool implements a custom code cache management policy that uses
+//  trace hotness.  Every trace counts its executions with an inlined counter.
+//  Each time the cache is full, traces that have not executed for -cold_age
+//  cache-full events are invalidated.  If most of the cached code is cold, the
+//  cache is flushed, which is cheap because little of it will be re-JITed.
+//  Otherwise the cache grows by one block (up to -max_cache) so that the hot
+//  code survives, and is flushed only when it cannot grow.
+//  Sample usage:
+//    pin -xyzzy -cc_memory_size 393216 -cache_block_size 65536 -t cache_hotness -- /bin/ls
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <unistd.h>
+#include "pin.H"
+#include "utils.H"
+#include "trace_counters.H"
+
+using namespace std;
+
+/* ================================================================== */
+/* Global Data Structures                                             */
+/* ================================================================== */
+
+/*
+  Hotness of all the traces at one application address.  A trace may
+  have several copies in the cache, and they all share a counter.
+*/
+struct TRACE_HOTNESS
+{
+    UINT64 *counter;        // Executions, incremented by the trace itself
+    UINT64 seen;            // Value of *counter at the last cache-full event
+    UINT32 lastActive;      // Last cache-full event at which the trace had executed
+    UINT32 bytes;           // Cache bytes used by the live copies
+};
+
+typedef map<ADDRINT, TRACE_HOTNESS> TRACE_MAP;
+TRACE_MAP traces;
+
+// Size and application address of each live trace, by its cache address
+typedef map<ADDRINT, pair<ADDRINT, UINT32> > COPY_MAP;
+COPY_MAP copies;
+
+TRACE_COUNTERS counters;
+
+UINT32 epoch = 0;
+UINT32 initialLimit = 0;
+UINT64 fulls = 0, grows = 0, flushes = 0;
+UINT64 coldTraces = 0, coldBytes = 0, hotBytesFlushed = 0;
+ofstream HotnessFile;
+
+/* ================================================================== */
+/* Command-Line Switches                                              */
+/* ================================================================== */
+KNOB<BOOL>  KnobHelp(KNOB_MODE_WRITEONCE, "pintool",
+    "hh", "0", "Print help message (command-line switches)");
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+    "o", "cache_hotness.out", "specify trace file name");
+KNOB<BOOL>   KnobPid(KNOB_MODE_WRITEONCE,                "pintool",
+    "p", "0", "append pid to output");
+KNOB<UINT32> KnobColdAge(KNOB_MODE_WRITEONCE, "pintool",
+    "cold_age", "2", "cache-full events without executing after which a trace is cold");
+KNOB<UINT32> KnobFlushColdPercent(KNOB_MODE_WRITEONCE, "pintool",
+    "flush_cold_percent", "50", "flush instead of growing when this percentage of the cache is cold");
+KNOB<UINT32> KnobMaxCache(KNOB_MODE_WRITEONCE, "pintool",
+    "max_cache", "0", "largest cache size to grow to, default is 4 times the initial limit");
+
+/* ================================================================== */
+/*
+ Open the output file
+*/
+VOID InitHotness()
+{
+    string logFileName = KnobOutputFile.Value();
+    if (KnobPid)
+    {
+        logFileName += "." + decstr(getpid());
+    }
+    HotnessFile.open(logFileName.c_str());
+}
+
+/* ================================================================== */
+/*
+ Print the policy's statistics
+*/
+VOID PrintHotnessInfo(INT32 code, VOID *v)
+{
+    HotnessFile << endl << fulls << " cache-full events" << endl;
+    HotnessFile << coldTraces << " cold traces invalidated (" << BytesToString(coldBytes) << ")" << endl;
+    HotnessFile << grows << " grows, final cache size: " << BytesToString(CODECACHE_CacheSizeLimit()) << endl;
+    HotnessFile << flushes << " flushes, hot code flushed: " << BytesToString(hotBytesFlushed) << endl;
+    HotnessFile << "#eof" << endl;
+    HotnessFile.close();
+
+    cout << "Cache Hotness Complete\n";
+}
+
+/* ================================================================== */
+/*
+ Count the executions of each trace
+*/
+VOID InstrumentTrace(TRACE trace, VOID *v)
+{
+    TRACE_MAP::iterator it = traces.find(TRACE_Address(trace));
+    if (it == traces.end())
+    {
+        TRACE_HOTNESS hotness;
+        hotness.counter = counters.New();
+        hotness.seen = 0;
+        hotness.lastActive = epoch;
+        hotness.bytes = 0;
+        it = traces.insert(make_pair(TRACE_Address(trace), hotness)).first;
+    }
+    TRACE_COUNTERS::Insert(trace, it->second.counter);
+}
+
+/* ================================================================== */
+/*
+ Keep track of the cache bytes used by each application address
+*/
+VOID TraceInserted(TRACE trace, VOID *v)
+{
+    TRACE_HOTNESS &hotness = traces[TRACE_Address(trace)];
+    UINT32 size = TRACE_CodeCacheSize(trace);
+
+    // A new trace is not cold until it has had a chance to run
+    hotness.lastActive = epoch;
+    hotness.bytes += size;
+    copies[TRACE_CodeCacheAddress(trace)] = make_pair(TRACE_Address(trace), size);
+}
+
+VOID TraceInvalidated(ADDRINT orig_pc, ADDRINT cache_pc, BOOL success)
+{
+    if (!success)
+        return;
+    COPY_MAP::iterator it = copies.find(cache_pc);
+    if (it == copies.end())
+        return;
+    traces[it->second.first].bytes -= it->second.second;
+    copies.erase(it);
+}
+
+VOID CacheFlushed()
+{
+    for (TRACE_MAP::iterator it = traces.begin(); it != traces.end(); ++it)
+        it->second.bytes = 0;
+    copies.clear();
+}
+
+/* ================================================================== */
+/*
+ Grow the cache by one block, if allowed
+*/
+BOOL GrowCache()
+{
+    USIZE blockSize = CODECACHE_BlockSize();
+    USIZE cacheSize = CODECACHE_CacheSizeLimit() + blockSize;
+    USIZE maxCache = KnobMaxCache.Value() ? KnobMaxCache.Value() : 4 * initialLimit;
+
+    if (cacheSize > maxCache)
+        return FALSE;
+    USIZE oldSize = CODECACHE_CacheSizeLimit();
+    if (!CODECACHE_ChangeCacheLimit(cacheSize))
+        return FALSE;
+    if (!CODECACHE_CreateNewCacheBlock(blockSize))
+    {
+        CODECACHE_ChangeCacheLimit(oldSize);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* ================================================================== */
+/*
+  When notified by Pin that the cache is full, age the traces,
+  invalidate the cold ones and decide whether to grow or flush.
+*/
+VOID HotnessOnFull(USIZE trace_size, USIZE stub_size)
+{
+    fulls++;
+    epoch++;
+
+    vector<ADDRINT> cold;
+    UINT64 hot = 0, coldNow = 0;
+    for (TRACE_MAP::iterator it = traces.begin(); it != traces.end(); ++it)
+    {
+        TRACE_HOTNESS &hotness = it->second;
+        if (*hotness.counter != hotness.seen)
+        {
+            hotness.seen = *hotness.counter;
+            hotness.lastActive = epoch;
+        }
+        if (!hotness.bytes)
+            continue;
+        if (epoch - hotness.lastActive >= KnobColdAge.Value())
+        {
+            cold.push_back(it->first);
+            coldNow += hotness.bytes;
+        }
+        else
+        {
+            hot += hotness.bytes;
+        }
+    }
+
+    // Invalidating does not return the space to the cache, but it unlinks
+    // the cold traces so they are re-JITed into a new block if they ever run
+    // again, and it keeps them from counting as hot code below.
+    for (vector<ADDRINT>::iterator it = cold.begin(); it != cold.end(); ++it)
+        coldTraces += CODECACHE_InvalidateTraceAtProgramAddress(*it);
+    coldBytes += coldNow;
+
+    HotnessFile << " FULL! (" << fulls << ")\thot: " << BytesToString(hot)
+                << "\tcold: " << BytesToString(coldNow) << endl;
+
+    UINT64 total = hot + coldNow;
+    if (total && coldNow * 100 < total * KnobFlushColdPercent.Value() && GrowCache())
+    {
+        grows++;
+        HotnessFile << " GROW! (" << grows << ")\tcache: "
+                    << BytesToString(CODECACHE_CacheSizeLimit()) << endl;
+        return;
+    }
+
+    flushes++;
+    hotBytesFlushed += hot;
+    CODECACHE_FlushCache();
+    HotnessFile << " SWOOSH! (" << flushes << ")\thot code lost: " << BytesToString(hot) << endl;
+}
+
+/* ================================================================== */
+/*
+ Remember the initial cache limit, which bounds the default growth
+*/
+VOID HotnessInit()
+{
+    initialLimit = CODECACHE_CacheSizeLimit();
+    PrintInitInfo();
+}
+
+/* ================================================================== */
+/*
+ Initialize and begin program execution under the control of Pin
+*/
+int main(INT32 argc, CHAR **argv)
+{
+    if (PIN_Init(argc, argv) || KnobHelp) return Usage();
+
+    // Initialize some local data structures
+    InitHotness();
+
+    // Count the executions of every trace
+    TRACE_AddInstrumentFunction(InstrumentTrace, 0);
+
+    // Register a routine that gets called when the cache is first initialized
+    CODECACHE_AddCacheInitFunction(HotnessInit, 0);
+
+    // Register routines that track the cache bytes used by each trace
+    CODECACHE_AddTraceInsertedFunction(TraceInserted, 0);
+    CODECACHE_AddTraceInvalidatedFunction(TraceInvalidated, 0);
+    CODECACHE_AddCacheFlushedFunction(CacheFlushed, 0);
+
+    // Register a routine that gets called every time the cache is full
+    CODECACHE_AddFullCacheFunction(HotnessOnFull, 0);
+
+    // Register a routine that gets called when the program ends
+    PIN_AddFiniFunction(PrintHotnessInfo, 0);
+
+    PIN_StartProgram();  // Never returns
+
+    return 0;
+}
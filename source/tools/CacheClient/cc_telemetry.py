@@ -0,0 +1,91 @@
+#!/usr/bin/env python
+# -*- python -*-
+
+'''
+Reader for the code cache telemetry written by mem_usage -telemetry.
+
+The file starts with a header (magic "PINCCTS1", version, sample size,
+sampling interval and start time in microseconds), followed by fixed-size
+samples of 64-bit counters.  The counters are totals since the start of the
+run; this script prints one CSV line per sample with the interval rates of
+the event counters next to the sizes, which makes JIT storms (bursts of
+insertions and links) and flushes easy to spot and to line up with icount.
+
+Example:
+> pin -t mem_usage -telemetry ls.cct -interval 50 -- /bin/ls
+> cc_telemetry.py ls.cct > ls.csv
+'''
+
+from __future__ import print_function
+
+import optparse
+import struct
+import sys
+
+MAGIC = b'PINCCTS1'
+HEADER = struct.Struct('=8sIIQQ')
+FIELDS = ['time_us', 'icount', 'insertions', 'links', 'unlinks',
+          'invalidations', 'flushes', 'blocks', 'code_reserved', 'code_used',
+          'exit_stub_bytes', 'directory_used', 'link_bytes',
+          'traces_in_cache', 'pin_memory']
+SAMPLE = struct.Struct('=%dQ' % len(FIELDS))
+
+# Event counters, printed as rates per second over each interval.
+RATES = ['icount', 'insertions', 'links', 'unlinks', 'invalidations',
+         'flushes']
+
+
+def read_samples(filename):
+    data = open(filename, 'rb').read()
+    magic, version, sample_bytes, interval_us, start_us = \
+        HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('%s is not a code cache telemetry file' % filename)
+    if version != 1 or sample_bytes != SAMPLE.size:
+        raise ValueError('unsupported telemetry version %d' % version)
+    samples = []
+    off = HEADER.size
+    while off + SAMPLE.size <= len(data):
+        samples.append(dict(zip(FIELDS, SAMPLE.unpack_from(data, off))))
+        off += SAMPLE.size
+    return interval_us, samples
+
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] <telemetry file>')
+    parser.add_option('-s', '--summary', action='store_true', default=False,
+                      help='only print the peak rates and final sizes')
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error('expected one telemetry file')
+
+    interval_us, samples = read_samples(args[0])
+    columns = FIELDS + [r + '_per_s' for r in RATES]
+    peaks = dict((r, 0.0) for r in RATES)
+    if not options.summary:
+        print(','.join(columns))
+
+    prev = dict((f, 0) for f in FIELDS)
+    for sample in samples:
+        seconds = (sample['time_us'] - prev['time_us']) / 1e6
+        rates = []
+        for r in RATES:
+            rate = (sample[r] - prev[r]) / seconds if seconds > 0 else 0.0
+            peaks[r] = max(peaks[r], rate)
+            rates.append('%.1f' % rate)
+        if not options.summary:
+            print(','.join([str(sample[f]) for f in FIELDS] + rates))
+        prev = sample
+
+    if options.summary:
+        print('samples %d  interval %d us' % (len(samples), interval_us))
+        for r in RATES:
+            print('peak %s/s %.1f' % (r, peaks[r]))
+        if samples:
+            for f in FIELDS[1:]:
+                print('final %s %d' % (f, samples[-1][f]))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
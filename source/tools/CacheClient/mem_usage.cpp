@@ -31,14 +31,21 @@ END_LEGAL */
 //  This tool reports Pin's memory usage over time. The intermittent
 //    memory usage is dumped to a file when verbosity is set. At the
 //    end of execution, the final memory usage is dumped to stdout.
+//  With -telemetry, a tool thread also samples the code cache and Pin
+//    memory counters every -interval milliseconds into a binary time
+//    series, see cc_telemetry.py for the format.
 //  Sample usage:
 //    pin -t mem_usage -- /bin/ls
+//    pin -t mem_usage -telemetry ls.cct -interval 50 -- /bin/ls
 
 #include <iostream>
 #include <fstream>
+#include <cstring>
 #include <unistd.h>
+#include <sys/time.h>
 #include "pin.H"
 #include "utils.H"
+#include "interval_timer.H"
 
 using namespace std;
 
@@ -51,6 +58,59 @@ int cacheblocks;
 int flushes;
 ofstream TraceFile;
 
+/*
+  One telemetry sample.  All counts are totals since the start of the
+  run; rates are the differences between consecutive samples.
+*/
+struct TELEMETRY_SAMPLE
+{
+    UINT64 timeUs;          // Monotonic time since the start of the run
+    UINT64 icount;          // Instructions executed by all threads
+    UINT64 insertions;      // Traces inserted into the cache
+    UINT64 links;           // Branches linked
+    UINT64 unlinks;         // Branches unlinked
+    UINT64 invalidations;   // Traces invalidated
+    UINT64 flushes;         // Cache flushes
+    UINT64 blocks;          // Cache blocks allocated
+    UINT64 codeReserved;    // CODECACHE_CodeMemReserved()
+    UINT64 codeUsed;        // CODECACHE_CodeMemUsed()
+    UINT64 exitStubBytes;   // CODECACHE_ExitStubBytes()
+    UINT64 directoryUsed;   // CODECACHE_DirectoryMemUsed()
+    UINT64 linkBytes;       // CODECACHE_LinkBytes()
+    UINT64 tracesInCache;   // CODECACHE_NumTracesInCache()
+    UINT64 pinMemory;       // PIN_MemoryAllocatedForPin()
+};
+
+/*
+  Header at the start of the telemetry file, followed by the samples
+*/
+struct TELEMETRY_HEADER
+{
+    char magic[8];          // "PINCCTS1"
+    UINT32 version;         // 1
+    UINT32 sampleBytes;     // sizeof(TELEMETRY_SAMPLE)
+    UINT64 intervalUs;      // Requested sampling interval
+    UINT64 startUs;         // Wall-clock time of the start of the run, only informative
+};
+
+// Event counts for the telemetry.  They are only written by Pin's
+// callbacks, and the sampling thread reads them without a lock, so a
+// sample may miss events that happen while it is taken.
+UINT64 telemetryLinks, telemetryUnlinks, telemetryInvalidations;
+
+// Per-thread instruction counts, each on its own cache line
+struct THREAD_ICOUNT
+{
+    UINT64 count;
+    UINT8 pad[56];
+};
+THREAD_ICOUNT threadIcounts[PIN_MAX_THREADS];
+
+ofstream TelemetryFile;
+UINT64 telemetryStartUs;  // MonotonicTimeUs() at the start of the run
+PIN_THREAD_UID telemetryThreadUid;
+volatile BOOL telemetryStop = FALSE;
+
 /* ================================================================== */
 /* Command-Line Switches                                              */
 /* ================================================================== */
@@ -62,6 +122,12 @@ KNOB<BOOL>  KnobPid(KNOB_MODE_WRITEONCE, "pintool",
     "p", "0", "append pid to output");
 KNOB<BOOL> KnobVerboseOutput(KNOB_MODE_WRITEONCE, "pintool",
     "v", "0", "Verbose output");
+KNOB<string> KnobTelemetryFile(KNOB_MODE_WRITEONCE, "pintool",
+    "telemetry", "", "write a binary time series of cache counters to this file");
+KNOB<UINT32> KnobTelemetryInterval(KNOB_MODE_WRITEONCE, "pintool",
+    "interval", "100", "milliseconds between telemetry samples");
+KNOB<BOOL> KnobTelemetryIcount(KNOB_MODE_WRITEONCE, "pintool",
+    "icount", "1", "count instructions for the telemetry (adds code to every trace)");
 
 /* ================================================================== */
 /*
@@ -157,6 +223,131 @@ VOID CollectBlockInfo(USIZE block_size )
     cacheblocks++;
 }
 
+/* ================================================================== */
+/*
+  Count the events that only the telemetry needs
+*/
+VOID CountLink(ADDRINT branch_pc, ADDRINT target_pc)
+{
+    telemetryLinks++;
+}
+
+VOID CountUnlink(ADDRINT branch_pc, ADDRINT stub_pc)
+{
+    telemetryUnlinks++;
+}
+
+VOID CountInvalidation(ADDRINT orig_pc, ADDRINT cache_pc, BOOL success)
+{
+    if (success)
+        telemetryInvalidations++;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL CountBbl(THREADID tid, UINT32 numIns)
+{
+    threadIcounts[tid].count += numIns;
+}
+
+VOID InstrumentTrace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBbl, IARG_FAST_ANALYSIS_CALL,
+                       IARG_THREAD_ID, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+    }
+}
+
+/* ================================================================== */
+/*
+  Take one telemetry sample and append it to the file
+*/
+VOID WriteTelemetrySample()
+{
+    TELEMETRY_SAMPLE sample;
+    sample.timeUs = INSTLIB::MonotonicTimeUs() - telemetryStartUs;
+    sample.icount = 0;
+    for (UINT32 i = 0; i < PIN_MAX_THREADS; i++)
+        sample.icount += threadIcounts[i].count;
+    sample.insertions = insertions;
+    sample.links = telemetryLinks;
+    sample.unlinks = telemetryUnlinks;
+    sample.invalidations = telemetryInvalidations;
+    sample.flushes = flushes;
+    sample.blocks = cacheblocks;
+    sample.codeReserved = CODECACHE_CodeMemReserved();
+    sample.codeUsed = CODECACHE_CodeMemUsed();
+    sample.exitStubBytes = CODECACHE_ExitStubBytes();
+    sample.directoryUsed = CODECACHE_DirectoryMemUsed();
+    sample.linkBytes = CODECACHE_LinkBytes();
+    sample.tracesInCache = CODECACHE_NumTracesInCache();
+    sample.pinMemory = PIN_MemoryAllocatedForPin();
+
+    TelemetryFile.write(reinterpret_cast<const char *>(&sample), sizeof(sample));
+}
+
+/* ================================================================== */
+/*
+  Tool thread that samples the counters at a fixed interval
+*/
+VOID TelemetryThread(VOID *)
+{
+    INSTLIB::INTERVAL_TIMER timer(KnobTelemetryInterval.Value());
+    while (timer.Wait(&telemetryStop))
+        WriteTelemetrySample();
+}
+
+/* ================================================================== */
+/*
+  Stop the sampling thread before Fini and write the final sample
+*/
+VOID StopTelemetry(VOID *)
+{
+    if (telemetryStop)
+        return;
+    telemetryStop = TRUE;
+    PIN_WaitForThreadTermination(telemetryThreadUid, PIN_INFINITE_TIMEOUT, 0);
+    WriteTelemetrySample();
+    TelemetryFile.close();
+}
+
+/* ================================================================== */
+/*
+  Open the telemetry file and start the sampling thread
+*/
+BOOL StartTelemetry()
+{
+    string fileName = KnobTelemetryFile.Value();
+    if (KnobPid)
+    {
+        fileName += "." + decstr(getpid());
+    }
+    TelemetryFile.open(fileName.c_str(), ios::binary);
+    if (!TelemetryFile)
+        return FALSE;
+
+    telemetryStartUs = INSTLIB::MonotonicTimeUs();
+    struct timeval now;
+    gettimeofday(&now, 0);
+    TELEMETRY_HEADER header;
+    memcpy(header.magic, "PINCCTS1", sizeof(header.magic));
+    header.version = 1;
+    header.sampleBytes = sizeof(TELEMETRY_SAMPLE);
+    header.intervalUs = static_cast<UINT64>(KnobTelemetryInterval.Value()) * 1000;
+    header.startUs = static_cast<UINT64>(now.tv_sec) * 1000000 + now.tv_usec;
+    TelemetryFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    CODECACHE_AddTraceLinkedFunction(CountLink, 0);
+    CODECACHE_AddTraceUnlinkedFunction(CountUnlink, 0);
+    CODECACHE_AddTraceInvalidatedFunction(CountInvalidation, 0);
+    if (KnobTelemetryIcount)
+        TRACE_AddInstrumentFunction(InstrumentTrace, 0);
+
+    if (PIN_SpawnInternalThread(TelemetryThread, 0, 0, &telemetryThreadUid) == INVALID_THREADID)
+        return FALSE;
+    PIN_AddPrepareForFiniFunction(StopTelemetry, 0);
+    return TRUE;
+}
+
 /* ================================================================== */
 /*
  Initialize and begin program execution under the control of Pin
@@ -184,6 +375,13 @@ int main(INT32 argc, CHAR **argv)
     // Register a routine that gets called when the program ends
     PIN_AddFiniFunction(PrintDetailsOnExit, 0);
 
+    // Sample the counters into a time series
+    if (!KnobTelemetryFile.Value().empty() && !StartTelemetry())
+    {
+        cerr << "mem_usage: cannot start telemetry to " << KnobTelemetryFile.Value() << endl;
+        return 1;
+    }
+
     PIN_StartProgram();  // Never returns
 
     return 0;
@@ -0,0 +1,389 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+//  This tool records the hot traces of a run in a profile and uses the
+//  profile to prepare the code cache on the next run of the same binaries.
+//  Traces are recorded by image-relative address, and images are keyed by
+//  their GNU build-id (or by path and size when there is none), so the
+//  profile stays valid when the images load at different addresses.
+//
+//  Pin cannot translate a trace without executing it, and executing
+//  application code out of order is not safe, so the next run cannot
+//  compile the hot traces ahead of time.  Instead, the cache limit is raised
+//  up front to the size the last run needed, so that no hot trace has to be
+//  re-JITed after a flush, and the tool reports how many of the recorded
+//  hot traces were JITed and re-JITed again.
+//  Sample usage:
+//    pin -t warm_start -profile ls.prof -- /bin/ls
+//    pin -t warm_start -profile ls.prof -- /bin/ls
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <vector>
+#include <unistd.h>
+#include "pin.H"
+#include "utils.H"
+#include "trace_counters.H"
+
+using namespace std;
+
+/* ================================================================== */
+/* Global Data Structures                                             */
+/* ================================================================== */
+
+/*
+  A hot trace, as recorded in the profile
+*/
+struct HOT_TRACE
+{
+    UINT64 count;           // Executions
+    UINT32 bytes;           // Cache bytes of one copy
+};
+
+/*
+  Hot traces of one image, by image-relative address
+*/
+struct IMAGE_PROFILE
+{
+    string name;
+    map<ADDRINT, HOT_TRACE> traces;
+};
+
+// Profile, keyed by image build-id or path
+typedef map<string, IMAGE_PROFILE> PROFILE;
+PROFILE oldProfile;
+UINT64 oldCodeBytes = 0;
+
+/*
+  A loaded image
+*/
+struct IMAGE_INFO
+{
+    string key;
+    string name;
+    ADDRINT low;
+};
+map<UINT32, IMAGE_INFO> images;
+
+/*
+  A trace of this run
+*/
+struct TRACE_INFO
+{
+    UINT64 *counter;        // Executions, incremented by the trace itself
+    UINT32 imgId;           // Image containing the trace, or zero
+    UINT32 bytes;           // Cache bytes of the last copy
+    UINT32 insertions;      // Copies inserted into the cache
+};
+typedef map<ADDRINT, TRACE_INFO> TRACE_MAP;
+TRACE_MAP traces;
+
+TRACE_COUNTERS counters;
+
+// Absolute addresses of the hot traces recorded by the last run
+set<ADDRINT> expected;
+UINT64 expectedJited = 0, expectedReJited = 0;
+UINT32 peakCodeBytes = 0;
+ofstream WarmFile;
+
+/* ================================================================== */
+/* Command-Line Switches                                              */
+/* ================================================================== */
+KNOB<BOOL>  KnobHelp(KNOB_MODE_WRITEONCE, "pintool",
+    "hh", "0", "Print help message (command-line switches)");
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+    "o", "warm_start.out", "specify trace file name");
+KNOB<BOOL>   KnobPid(KNOB_MODE_WRITEONCE,                "pintool",
+    "p", "0", "append pid to output");
+KNOB<string> KnobProfile(KNOB_MODE_WRITEONCE, "pintool",
+    "profile", "warm_start.prof", "profile read at startup and rewritten at exit");
+KNOB<UINT64> KnobHot(KNOB_MODE_WRITEONCE, "pintool",
+    "hot", "100", "executions after which a trace is recorded as hot");
+
+/* ================================================================== */
+/*
+ Read the profile of the last run, if there is one.  The format is:
+   cache <code bytes>
+   image <key> <name>
+   <offset> <count> <bytes>
+*/
+VOID ReadProfile()
+{
+    ifstream in(KnobProfile.Value().c_str());
+    string line;
+    IMAGE_PROFILE *image = 0;
+
+    while (getline(in, line))
+    {
+        istringstream is(line);
+        string word;
+        if (!(is >> word))
+            continue;
+        if (word == "cache")
+        {
+            is >> oldCodeBytes;
+        }
+        else if (word == "image")
+        {
+            string key;
+            is >> key;
+            image = &oldProfile[key];
+            is >> ws;
+            getline(is, image->name);
+        }
+        else if (image)
+        {
+            HOT_TRACE hot;
+            ADDRINT offset = Uint64FromString(word);
+            if (is >> hot.count >> hot.bytes)
+                image->traces[offset] = hot;
+        }
+    }
+}
+
+/* ================================================================== */
+/*
+ Write the hot traces of this run, keeping the last run's entries
+ for images that were not loaded this time
+*/
+VOID WriteProfile()
+{
+    PROFILE profile;
+    for (TRACE_MAP::iterator it = traces.begin(); it != traces.end(); ++it)
+    {
+        TRACE_INFO &info = it->second;
+        if (*info.counter < KnobHot.Value() || !images.count(info.imgId))
+            continue;
+        IMAGE_INFO &img = images[info.imgId];
+        IMAGE_PROFILE &image = profile[img.key];
+        image.name = img.name;
+        HOT_TRACE hot;
+        hot.count = *info.counter;
+        hot.bytes = info.bytes;
+        image.traces[it->first - img.low] = hot;
+    }
+    for (PROFILE::iterator it = oldProfile.begin(); it != oldProfile.end(); ++it)
+    {
+        BOOL loaded = FALSE;
+        for (map<UINT32, IMAGE_INFO>::iterator img = images.begin(); img != images.end(); ++img)
+            loaded |= (img->second.key == it->first);
+        if (!loaded)
+            profile[it->first] = it->second;
+    }
+
+    ofstream out(KnobProfile.Value().c_str());
+    out << "cache " << dec << max<UINT64>(peakCodeBytes, oldCodeBytes) << endl;
+    for (PROFILE::iterator it = profile.begin(); it != profile.end(); ++it)
+    {
+        out << "image " << it->first << " " << it->second.name << endl;
+        for (map<ADDRINT, HOT_TRACE>::iterator t = it->second.traces.begin(); t != it->second.traces.end(); ++t)
+            out << hexstr(t->first) << " " << dec << t->second.count << " " << t->second.bytes << endl;
+    }
+}
+
+/* ================================================================== */
+/*
+ Return the GNU build-id of an image as a hex string, or an empty
+ string if the image has none
+*/
+string BuildId(IMG img)
+{
+    for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+    {
+        if (SEC_Name(sec) != ".note.gnu.build-id" || !SEC_Mapped(sec) || SEC_Size(sec) < 16)
+            continue;
+
+        // Elf note: namesz, descsz, type, "GNU\0", then the id itself
+        const UINT32 *note = reinterpret_cast<const UINT32 *>(SEC_Address(sec));
+        UINT32 nameSize = (note[0] + 3) & ~3;
+        UINT32 idSize = note[1];
+        if (12 + nameSize + idSize > SEC_Size(sec))
+            return "";
+        const UINT8 *id = reinterpret_cast<const UINT8 *>(note) + 12 + nameSize;
+
+        static const char digits[] = "0123456789abcdef";
+        string text;
+        for (UINT32 i = 0; i < idSize; i++)
+        {
+            text += digits[id[i] >> 4];
+            text += digits[id[i] & 0xf];
+        }
+        return text;
+    }
+    return "";
+}
+
+/* ================================================================== */
+/*
+ Key an image by its build-id, and expect the hot traces that the
+ last run recorded for it
+*/
+VOID ImageLoad(IMG img, VOID *v)
+{
+    IMAGE_INFO info;
+    info.name = IMG_Name(img);
+    info.low = IMG_LowAddress(img);
+    info.key = BuildId(img);
+    if (info.key.empty())
+        info.key = "path:" + info.name + ":" + decstr(IMG_HighAddress(img) - IMG_LowAddress(img));
+    images[IMG_Id(img)] = info;
+
+    PROFILE::iterator it = oldProfile.find(info.key);
+    if (it == oldProfile.end())
+        return;
+    for (map<ADDRINT, HOT_TRACE>::iterator t = it->second.traces.begin(); t != it->second.traces.end(); ++t)
+        expected.insert(info.low + t->first);
+    WarmFile << "Expecting " << it->second.traces.size() << " hot traces in " << info.name << endl;
+}
+
+/* ================================================================== */
+/*
+ Count the executions of each trace
+*/
+VOID InstrumentTrace(TRACE trace, VOID *v)
+{
+    TRACE_MAP::iterator it = traces.find(TRACE_Address(trace));
+    if (it == traces.end())
+    {
+        TRACE_INFO info;
+        info.counter = counters.New();
+        IMG img = IMG_FindByAddress(TRACE_Address(trace));
+        info.imgId = IMG_Valid(img) ? IMG_Id(img) : 0;
+        info.bytes = 0;
+        info.insertions = 0;
+        it = traces.insert(make_pair(TRACE_Address(trace), info)).first;
+    }
+    TRACE_COUNTERS::Insert(trace, it->second.counter);
+}
+
+/* ================================================================== */
+/*
+ Keep track of the cache usage, and of the expected hot traces that
+ had to be JITed again
+*/
+VOID TraceInserted(TRACE trace, VOID *v)
+{
+    TRACE_INFO &info = traces[TRACE_Address(trace)];
+    info.bytes = TRACE_CodeCacheSize(trace);
+    info.insertions++;
+
+    if (expected.count(TRACE_Address(trace)))
+    {
+        if (info.insertions == 1)
+            expectedJited++;
+        else
+            expectedReJited++;
+    }
+
+    UINT32 used = CODECACHE_CodeMemUsed();
+    if (used > peakCodeBytes)
+        peakCodeBytes = used;
+}
+
+/* ================================================================== */
+/*
+ Raise the cache limit to what the last run needed, rounded up to
+ whole blocks
+*/
+VOID WarmInit()
+{
+    PrintInitInfo();
+
+    UINT32 limit = CODECACHE_CacheSizeLimit();
+    UINT32 block = CODECACHE_BlockSize();
+    if (!limit || !oldCodeBytes || oldCodeBytes <= limit || !block)
+        return;
+
+    USIZE wanted = ((oldCodeBytes + block - 1) / block) * block;
+    if (CODECACHE_ChangeCacheLimit(wanted))
+        WarmFile << "Cache limit raised to " << BytesToString(wanted) << endl;
+    else
+        WarmFile << "Could not raise cache limit to " << BytesToString(wanted) << endl;
+}
+
+/* ================================================================== */
+/*
+ Write the profile and print how well the last one matched
+*/
+VOID WarmFini(INT32 code, VOID *v)
+{
+    WriteProfile();
+
+    UINT64 hot = 0;
+    for (TRACE_MAP::iterator it = traces.begin(); it != traces.end(); ++it)
+        hot += (*it->second.counter >= KnobHot.Value());
+
+    WarmFile << endl << traces.size() << " traces, " << hot << " hot" << endl;
+    WarmFile << expectedJited << " of " << expected.size() << " hot traces from profile JITed, "
+             << expectedReJited << " re-JITed" << endl;
+    WarmFile << "Peak code cache use: " << BytesToString(peakCodeBytes) << endl;
+    WarmFile << "#eof" << endl;
+    WarmFile.close();
+}
+
+/* ================================================================== */
+/*
+ Initialize and begin program execution under the control of Pin
+*/
+int main(INT32 argc, CHAR **argv)
+{
+    if (PIN_Init(argc, argv) || KnobHelp) return Usage();
+
+    string logFileName = KnobOutputFile.Value();
+    if (KnobPid)
+    {
+        logFileName += "." + decstr(getpid());
+    }
+    WarmFile.open(logFileName.c_str());
+    ReadProfile();
+
+    // Key images and find the hot traces the last run recorded for them
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+
+    // Count the executions of every trace
+    TRACE_AddInstrumentFunction(InstrumentTrace, 0);
+
+    // Register a routine that gets called when the cache is first initialized
+    CODECACHE_AddCacheInitFunction(WarmInit, 0);
+
+    // Register a routine that gets called when a trace is
+    //  inserted into the codecache
+    CODECACHE_AddTraceInsertedFunction(TraceInserted, 0);
+
+    // Register a routine that gets called when the program ends
+    PIN_AddFiniFunction(WarmFini, 0);
+
+    PIN_StartProgram();  // Never returns
+
+    return 0;
+}
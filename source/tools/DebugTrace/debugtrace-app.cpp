@@ -0,0 +1,82 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*
+ * A small deterministic application for the debugtrace tests.  Only the code
+ * between marker_start_tracing() and marker_stop_tracing() is traced, and it
+ * touches nothing but globals, so two runs with ASLR disabled give the same
+ * trace.
+ */
+
+#if defined(_MSC_VER)
+#   define NOINLINE __declspec(noinline)
+#else
+#   define NOINLINE __attribute__((noinline))
+#endif
+
+extern "C" {
+
+void marker_start_tracing()
+{
+}
+
+void marker_stop_tracing()
+{
+}
+
+} // end of extern "C"
+
+volatile unsigned long Values[16];
+volatile double Scale = 1.5;
+
+static NOINLINE unsigned long Mix(unsigned long a, unsigned long b)
+{
+    return (a * 31) ^ (b + 7);
+}
+
+static NOINLINE double Weight(unsigned long a)
+{
+    return a * Scale;
+}
+
+int main()
+{
+    marker_start_tracing();
+    unsigned long sum = 0;
+    double weighted = 0;
+    for (unsigned i = 0; i < 16; i++)
+    {
+        Values[i] = Mix(i, sum);
+        sum += Values[i];
+        weighted += Weight(Values[i]);
+    }
+    marker_stop_tracing();
+    return (sum + static_cast<unsigned long>(weighted)) == 0;
+}
@@ -0,0 +1,350 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*! @file
+ *  Formats a trace written by "debugtrace -binary" as the same text that
+ *  debugtrace writes without -binary.
+ *
+ *  Usage: debugtrace-format [-o <output file>] <binary trace>
+ *
+ *  The records of each thread are in order. The threads are interleaved
+ *  at the granularity of the per-thread buffers of the tool.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+typedef void VOID;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef int32_t INT32;
+typedef uint64_t UINT64;
+typedef uintptr_t ADDRINT;
+
+#include "debugtrace_format.H"
+
+using namespace std;
+
+struct INS_DESCRIPTOR
+{
+    UINT32 str;
+    vector<UINT32> names;
+};
+
+class TRACE_READER
+{
+  public:
+    TRACE_READER(istream & in, ostream & out)
+        : _in(in), _formatter(out, false), _out(out), _addrSize(0)
+    {}
+
+    bool Run()
+    {
+        char magic[8];
+        if (!_in.read(magic, sizeof(magic)) || memcmp(magic, DEBUGTRACE_MAGIC, sizeof(magic)) != 0)
+            return Error("not a debugtrace binary trace");
+        _addrSize = Get<UINT32>(_in);
+        if (_addrSize != 4 && _addrSize != 8)
+            return Error("bad address size");
+
+        for (;;)
+        {
+            int tag = _in.get();
+            if (tag == EOF)
+                return true;
+            switch (tag)
+            {
+              case DT_FILE_STRING:
+                {
+                    UINT32 id = Get<UINT32>(_in);
+                    string str = GetString(_in);
+                    if (id >= _strings.size())
+                        _strings.resize(id + 1);
+                    _strings[id] = str;
+                }
+                break;
+
+              case DT_FILE_INS:
+                {
+                    UINT32 id = Get<UINT32>(_in);
+                    INS_DESCRIPTOR ins;
+                    ins.str = Get<UINT32>(_in);
+                    UINT32 n = Get<UINT32>(_in);
+                    for (UINT32 i = 0; i < n; i++)
+                        ins.names.push_back(Get<UINT32>(_in));
+                    if (id >= _ins.size())
+                        _ins.resize(id + 1);
+                    _ins[id] = ins;
+                }
+                break;
+
+              case DT_FILE_CHUNK:
+                {
+                    Get<UINT32>(_in); // tid
+                    UINT32 len = Get<UINT32>(_in);
+                    _chunk.resize(len);
+                    if (len && !_in.read(&_chunk[0], len))
+                        return Error("truncated chunk");
+                    if (!Chunk())
+                        return false;
+                }
+                break;
+
+              case DT_FILE_TEXT:
+                _out << GetString(_in);
+                break;
+
+              default:
+                return Error("bad file record");
+            }
+            if (!_in)
+                return Error("truncated trace");
+        }
+    }
+
+  private:
+    template <typename T> static T Get(istream & in)
+    {
+        T x = 0;
+        in.read(reinterpret_cast<char *>(&x), sizeof(x));
+        return x;
+    }
+
+    static string GetString(istream & in)
+    {
+        UINT32 len = Get<UINT32>(in);
+        string s(len, '\0');
+        if (len)
+            in.read(&s[0], len);
+        return s;
+    }
+
+    // Get values out of the current chunk.
+    template <typename T> T Take()
+    {
+        T x = 0;
+        if (_pos + sizeof(x) <= _chunk.size())
+            memcpy(&x, &_chunk[_pos], sizeof(x));
+        _pos += sizeof(x);
+        return x;
+    }
+
+    UINT64 TakeAddr()
+    {
+        return _addrSize == 4 ? Take<UINT32>() : Take<UINT64>();
+    }
+
+    // Returns NULL, and moves to the end of the chunk, if fewer than n bytes are left.
+    const UINT8 * TakeBytes(UINT32 n)
+    {
+        if (_pos + n > _chunk.size())
+        {
+            _pos = _chunk.size() + 1;
+            return 0;
+        }
+        const UINT8 * p = reinterpret_cast<const UINT8 *>(&_chunk[0]) + _pos;
+        _pos += n;
+        return p;
+    }
+
+    const string & String(UINT32 id)
+    {
+        static const string unknown = "???";
+        return id < _strings.size() ? _strings[id] : unknown;
+    }
+
+    bool Chunk()
+    {
+        _pos = 0;
+        while (_pos < _chunk.size())
+        {
+            UINT8 type = Take<UINT8>();
+            switch (type)
+            {
+              case DT_INS:
+                {
+                    UINT32 id = Take<UINT32>();
+                    if (id >= _ins.size())
+                        return Error("unknown instruction");
+                    const INS_DESCRIPTOR & ins = _ins[id];
+                    const string * names[4];
+                    UINT64 values[4];
+                    UINT32 n = ins.names.size();
+                    if (n > 4)
+                        return Error("too many registers");
+                    for (UINT32 i = 0; i < n; i++)
+                    {
+                        names[i] = &String(ins.names[i]);
+                        values[i] = TakeAddr();
+                    }
+                    _formatter.Values(String(ins.str), n, names, values);
+                }
+                break;
+
+              case DT_XMM:
+                {
+                    UINT32 regno = Take<UINT32>();
+                    if (_pos + 16 > _chunk.size())
+                        return Error("truncated xmm record");
+                    _formatter.Xmm(regno, TakeBytes(16));
+                }
+                break;
+
+              case DT_READ:
+              case DT_WRITE:
+                {
+                    UINT64 ea = TakeAddr();
+                    UINT32 size = Take<UINT32>();
+                    if (_pos + size > _chunk.size())
+                        return Error("truncated memory record");
+                    const UINT8 * bytes = TakeBytes(size);
+                    if (type == DT_WRITE)
+                        _formatter.Write(ea, size, bytes);
+                    else
+                        _formatter.Read(ea, size, bytes);
+                }
+                break;
+
+              case DT_DIRECT_CALL:
+                {
+                    UINT32 str = Take<UINT32>();
+                    UINT32 tailCall = Take<UINT32>();
+                    UINT64 icount = Take<UINT64>();
+                    UINT64 arg0 = TakeAddr();
+                    UINT64 arg1 = TakeAddr();
+                    _formatter.DirectCall(icount, String(str), tailCall != 0, arg0, arg1);
+                }
+                break;
+
+              case DT_INDIRECT_CALL:
+                {
+                    UINT32 str = Take<UINT32>();
+                    UINT32 target = Take<UINT32>();
+                    UINT64 icount = Take<UINT64>();
+                    UINT64 arg0 = TakeAddr();
+                    UINT64 arg1 = TakeAddr();
+                    _formatter.IndirectCall(icount, String(str), String(target), arg0, arg1);
+                }
+                break;
+
+              case DT_RETURN:
+                {
+                    UINT32 str = Take<UINT32>();
+                    UINT64 icount = Take<UINT64>();
+                    UINT64 ret0 = TakeAddr();
+                    _formatter.Return(icount, String(str), ret0);
+                }
+                break;
+
+              case DT_TEXT:
+                {
+                    UINT32 len = Take<UINT32>();
+                    if (_pos + len > _chunk.size())
+                        return Error("truncated text record");
+                    _out.write(reinterpret_cast<const char *>(TakeBytes(len)), len);
+                }
+                break;
+
+              default:
+                return Error("bad record");
+            }
+        }
+        if (_pos != _chunk.size())
+            return Error("truncated record");
+        return true;
+    }
+
+    bool Error(const char * msg)
+    {
+        _out << flush;
+        cerr << "debugtrace-format: " << msg << endl;
+        return false;
+    }
+
+    istream & _in;
+    DEBUGTRACE_FORMATTER _formatter;
+    ostream & _out;
+    UINT32 _addrSize;
+    vector<string> _strings;
+    vector<INS_DESCRIPTOR> _ins;
+    vector<char> _chunk;
+    size_t _pos;
+};
+
+int main(int argc, char *argv[])
+{
+    const char * output = 0;
+    const char * input = 0;
+    bool usage = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (!input)
+            input = argv[i];
+        else
+            usage = true;
+    }
+    if (!input || usage)
+    {
+        cerr << "Usage: debugtrace-format [-o <output file>] <binary trace>" << endl;
+        return 1;
+    }
+
+    ifstream in(input, ios::in | ios::binary);
+    if (!in)
+    {
+        cerr << "debugtrace-format: cannot open " << input << endl;
+        return 1;
+    }
+
+    ofstream file;
+    if (output)
+    {
+        file.open(output);
+        if (!file)
+        {
+            cerr << "debugtrace-format: cannot open " << output << endl;
+            return 1;
+        }
+    }
+    ostream & out = output ? file : cout;
+    out << hex << right;
+    out.setf(ios::showbase);
+
+    TRACE_READER reader(in, out);
+    return reader.Run() ? 0 : 1;
+}
@@ -36,13 +36,18 @@ END_LEGAL */
 
 
 #include <vector>
+#include <map>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
+#include <string.h>
 #include <unistd.h>
 #include "pin.H"
 #include "instlib.H"
 #include "control_manager.H"
+#include "debugtrace_format.H"
+#include "flight_recorder.H"
 
 using namespace CONTROLLER;
 using namespace INSTLIB;
@@ -72,6 +77,13 @@ KNOB<BOOL>   KnobTraceMemory(KNOB_MODE_WRITEONCE,       "pintool",
 KNOB<BOOL>   KnobSilent(KNOB_MODE_WRITEONCE,       "pintool",
     "silent", "0", "Do everything but write file (for debugging).");
 KNOB<BOOL> KnobEarlyOut(KNOB_MODE_WRITEONCE, "pintool", "early_out", "0" , "Exit after tracing the first region.");
+KNOB<BOOL>   KnobBinary(KNOB_MODE_WRITEONCE,       "pintool",
+    "binary", "0", "Write a binary trace, format it with debugtrace-format");
+KNOB<UINT32> KnobBufferSize(KNOB_MODE_WRITEONCE,       "pintool",
+    "buffer_size", "1024", "Size of the per thread record buffers in KB for -binary");
+KNOB<UINT32> KnobFlightRecorder(KNOB_MODE_WRITEONCE,       "pintool",
+    "flight_recorder", "0", "Only keep the last n events of each thread and write them on a fatal signal, "
+    "a stats-emit controller event or at exit (0 to trace everything)");
 
 
 /* ===================================================================== */
@@ -95,12 +107,16 @@ INT32 Usage()
 
 LOCALVAR std::ofstream out;
 
+LOCALVAR DEBUGTRACE_FORMATTER formatter(out, true);
+
 LOCALVAR INT32 enabled = 0;
 
 LOCALVAR FILTER filter;
 
 LOCALVAR ICOUNT icount;
 
+LOCALVAR FLIGHT_RECORDER recorder;
+
 LOCALFUN BOOL Emit(THREADID threadid)
 {
     if (!enabled ||
@@ -120,7 +136,7 @@ LOCALFUN VOID Flush()
 
 LOCALFUN VOID Fini(int, VOID * v);
 
-LOCALFUN VOID Handler(EVENT_TYPE ev, VOID *, CONTEXT * ctxt, VOID *, THREADID, bool bcast)
+LOCALFUN VOID Handler(EVENT_TYPE ev, VOID *, CONTEXT * ctxt, VOID *, THREADID tid, bool bcast)
 {
     switch(ev)
     {
@@ -148,6 +164,11 @@ LOCALFUN VOID Handler(EVENT_TYPE ev, VOID *, CONTEXT * ctxt, VOID *, THREADID, b
 #endif
         break;
 
+      case EVENT_STATS_EMIT:
+        if (recorder.IsActive())
+            recorder.Dump(out, "stats-emit event on thread " + decstr(tid), tid);
+        break;
+
       default:
         ASSERTX(false);
     }
@@ -161,9 +182,7 @@ VOID EmitNoValues(THREADID threadid, string * str)
     if (!Emit(threadid))
         return;
 
-    out
-        << *str
-        << endl;
+    formatter.Values(*str, 0, 0, 0);
 
     Flush();
 }
@@ -173,10 +192,9 @@ VOID Emit1Values(THREADID threadid, string * str, string * reg1str, ADDRINT reg1
     if (!Emit(threadid))
         return;
 
-    out
-        << *str << " | "
-        << *reg1str << " = " << reg1val
-        << endl;
+    const string * names[] = { reg1str };
+    const UINT64 values[] = { reg1val };
+    formatter.Values(*str, 1, names, values);
 
     Flush();
 }
@@ -186,11 +204,9 @@ VOID Emit2Values(THREADID threadid, string * str, string * reg1str, ADDRINT reg1
     if (!Emit(threadid))
         return;
 
-    out
-        << *str << " | "
-        << *reg1str << " = " << reg1val
-        << ", " << *reg2str << " = " << reg2val
-        << endl;
+    const string * names[] = { reg1str, reg2str };
+    const UINT64 values[] = { reg1val, reg2val };
+    formatter.Values(*str, 2, names, values);
 
     Flush();
 }
@@ -200,12 +216,9 @@ VOID Emit3Values(THREADID threadid, string * str, string * reg1str, ADDRINT reg1
     if (!Emit(threadid))
         return;
 
-    out
-        << *str << " | "
-        << *reg1str << " = " << reg1val
-        << ", " << *reg2str << " = " << reg2val
-        << ", " << *reg3str << " = " << reg3val
-        << endl;
+    const string * names[] = { reg1str, reg2str, reg3str };
+    const UINT64 values[] = { reg1val, reg2val, reg3val };
+    formatter.Values(*str, 3, names, values);
 
     Flush();
 }
@@ -216,18 +229,241 @@ VOID Emit4Values(THREADID threadid, string * str, string * reg1str, ADDRINT reg1
     if (!Emit(threadid))
         return;
 
-    out
-        << *str << " | "
-        << *reg1str << " = " << reg1val
-        << ", " << *reg2str << " = " << reg2val
-        << ", " << *reg3str << " = " << reg3val
-        << ", " << *reg4str << " = " << reg4val
-        << endl;
+    const string * names[] = { reg1str, reg2str, reg3str, reg4str };
+    const UINT64 values[] = { reg1val, reg2val, reg3val, reg4val };
+    formatter.Values(*str, 4, names, values);
 
     Flush();
 }
 
 
+/* ===================================================================== */
+/* Binary trace */
+/* ===================================================================== */
+
+// With -binary the analysis routines only append fixed records to a buffer
+// per thread; see debugtrace_format.H for the layout. Strings are written
+// once when they are created and referred to by id, and debugtrace-format
+// turns the file into the same text the tool writes otherwise. Threads
+// only take the file lock to write out a full buffer.
+
+LOCALVAR PIN_LOCK fileLock;
+LOCALVAR UINT32 nextStringId = 0;
+LOCALVAR UINT32 nextInsId = 0;
+LOCALVAR map<REG, UINT32> regNameIds;
+LOCALVAR map<ADDRINT, UINT32> targetStringIds;
+
+template <typename T> LOCALFUN UINT8 * Put(UINT8 * p, T value)
+{
+    memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+}
+
+LOCALFUN VOID WriteFile(const VOID * data, size_t size)
+{
+    out.write(static_cast<const char *>(data), size);
+}
+
+class THREAD_BUFFER
+{
+  public:
+    THREAD_BUFFER(THREADID tid, size_t size)
+        : _tid(tid), _size(size), _used(0), _buf(new UINT8[size])
+    {}
+
+    ~THREAD_BUFFER()
+    {
+        delete [] _buf;
+    }
+
+    // Return room for a record of size bytes, which is then added with Commit().
+    UINT8 * Reserve(size_t size)
+    {
+        if (_used + size > _size)
+        {
+            Flush();
+            if (size > _size)
+            {
+                delete [] _buf;
+                _size = size;
+                _buf = new UINT8[_size];
+            }
+        }
+        return _buf + _used;
+    }
+
+    VOID Commit(UINT8 * end)
+    {
+        _used = end - _buf;
+    }
+
+    VOID Flush()
+    {
+        if (_used == 0)
+            return;
+        UINT8 header[1 + 2*sizeof(UINT32)];
+        UINT8 * p = Put(header, static_cast<UINT8>(DT_FILE_CHUNK));
+        p = Put(p, static_cast<UINT32>(_tid));
+        Put(p, static_cast<UINT32>(_used));
+
+        PIN_GetLock(&fileLock, _tid+1);
+        WriteFile(header, sizeof(header));
+        WriteFile(_buf, _used);
+        PIN_ReleaseLock(&fileLock);
+        _used = 0;
+    }
+
+  private:
+    const THREADID _tid;
+    size_t _size;
+    size_t _used;
+    UINT8 * _buf;
+};
+
+LOCALVAR THREAD_BUFFER * buffers[PIN_MAX_THREADS];
+
+LOCALFUN THREAD_BUFFER * Buffer(THREADID threadid)
+{
+    if (buffers[threadid] == 0)
+        buffers[threadid] = new THREAD_BUFFER(threadid, static_cast<size_t>(KnobBufferSize.Value()) << 10);
+    return buffers[threadid];
+}
+
+LOCALFUN VOID FlushBuffer(THREADID threadid)
+{
+    if (buffers[threadid])
+        buffers[threadid]->Flush();
+}
+
+// Add a string to the trace and return its id.
+LOCALFUN UINT32 NewString(const string & str)
+{
+    UINT8 header[1 + 2*sizeof(UINT32)];
+
+    PIN_GetLock(&fileLock, PIN_ThreadId()+1);
+    UINT32 id = nextStringId++;
+    UINT8 * p = Put(header, static_cast<UINT8>(DT_FILE_STRING));
+    p = Put(p, id);
+    Put(p, static_cast<UINT32>(str.size()));
+    WriteFile(header, sizeof(header));
+    WriteFile(str.data(), str.size());
+    PIN_ReleaseLock(&fileLock);
+
+    return id;
+}
+
+// Add an instruction descriptor (its text and the names of the registers
+// that are traced) to the trace and return its id.
+LOCALFUN UINT32 NewIns(const string & traceString, UINT32 regCount, REG regs[])
+{
+    vector<UINT32> names;
+    for (UINT32 i = 0; i < regCount; i++)
+    {
+        map<REG, UINT32>::iterator it = regNameIds.find(regs[i]);
+        if (it == regNameIds.end())
+            it = regNameIds.insert(make_pair(regs[i], NewString(REG_StringShort(regs[i])))).first;
+        names.push_back(it->second);
+    }
+    UINT32 str = NewString(traceString);
+
+    vector<UINT8> record(1 + (3 + regCount) * sizeof(UINT32));
+    PIN_GetLock(&fileLock, PIN_ThreadId()+1);
+    UINT32 id = nextInsId++;
+    UINT8 * p = Put(&record[0], static_cast<UINT8>(DT_FILE_INS));
+    p = Put(p, id);
+    p = Put(p, str);
+    p = Put(p, regCount);
+    for (UINT32 i = 0; i < regCount; i++)
+        p = Put(p, names[i]);
+    WriteFile(&record[0], record.size());
+    PIN_ReleaseLock(&fileLock);
+
+    return id;
+}
+
+LOCALFUN VOID WriteText(const string & text)
+{
+    UINT8 header[1 + sizeof(UINT32)];
+    Put(Put(header, static_cast<UINT8>(DT_FILE_TEXT)), static_cast<UINT32>(text.size()));
+
+    PIN_GetLock(&fileLock, PIN_ThreadId()+1);
+    WriteFile(header, sizeof(header));
+    WriteFile(text.data(), text.size());
+    PIN_ReleaseLock(&fileLock);
+}
+
+VOID BinaryEmitNoValues(THREADID threadid, UINT32 id)
+{
+    if (!Emit(threadid))
+        return;
+
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + sizeof(UINT32));
+    p = Put(p, static_cast<UINT8>(DT_INS));
+    p = Put(p, id);
+    buf->Commit(p);
+}
+
+VOID BinaryEmit1Values(THREADID threadid, UINT32 id, ADDRINT reg1val)
+{
+    if (!Emit(threadid))
+        return;
+
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + sizeof(UINT32) + sizeof(ADDRINT));
+    p = Put(p, static_cast<UINT8>(DT_INS));
+    p = Put(p, id);
+    p = Put(p, reg1val);
+    buf->Commit(p);
+}
+
+VOID BinaryEmit2Values(THREADID threadid, UINT32 id, ADDRINT reg1val, ADDRINT reg2val)
+{
+    if (!Emit(threadid))
+        return;
+
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + sizeof(UINT32) + 2*sizeof(ADDRINT));
+    p = Put(p, static_cast<UINT8>(DT_INS));
+    p = Put(p, id);
+    p = Put(p, reg1val);
+    p = Put(p, reg2val);
+    buf->Commit(p);
+}
+
+VOID BinaryEmit3Values(THREADID threadid, UINT32 id, ADDRINT reg1val, ADDRINT reg2val, ADDRINT reg3val)
+{
+    if (!Emit(threadid))
+        return;
+
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + sizeof(UINT32) + 3*sizeof(ADDRINT));
+    p = Put(p, static_cast<UINT8>(DT_INS));
+    p = Put(p, id);
+    p = Put(p, reg1val);
+    p = Put(p, reg2val);
+    p = Put(p, reg3val);
+    buf->Commit(p);
+}
+
+VOID BinaryEmit4Values(THREADID threadid, UINT32 id, ADDRINT reg1val, ADDRINT reg2val, ADDRINT reg3val, ADDRINT reg4val)
+{
+    if (!Emit(threadid))
+        return;
+
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + sizeof(UINT32) + 4*sizeof(ADDRINT));
+    p = Put(p, static_cast<UINT8>(DT_INS));
+    p = Put(p, id);
+    p = Put(p, reg1val);
+    p = Put(p, reg2val);
+    p = Put(p, reg3val);
+    p = Put(p, reg4val);
+    buf->Commit(p);
+}
+
+/* ===================================================================== */
+
 const UINT32 MaxEmitArgs = 4;
 
 AFUNPTR emitFuns[] =
@@ -235,27 +471,48 @@ AFUNPTR emitFuns[] =
     AFUNPTR(EmitNoValues), AFUNPTR(Emit1Values), AFUNPTR(Emit2Values), AFUNPTR(Emit3Values), AFUNPTR(Emit4Values)
 };
 
+AFUNPTR binaryEmitFuns[] =
+{
+    AFUNPTR(BinaryEmitNoValues), AFUNPTR(BinaryEmit1Values), AFUNPTR(BinaryEmit2Values),
+    AFUNPTR(BinaryEmit3Values), AFUNPTR(BinaryEmit4Values)
+};
+
+// Pass a string that is formatted at instrumentation time to an analysis
+// routine: a string* for the text trace, a string id for the binary trace.
+LOCALFUN VOID AddStringArgument(IARGLIST args, const string & str)
+{
+    if (KnobBinary)
+        IARGLIST_AddArguments(args, IARG_UINT32, NewString(str), IARG_END);
+    else
+        IARGLIST_AddArguments(args, IARG_PTR, new string(str), IARG_END);
+}
+
 /* ===================================================================== */
 
 VOID EmitXMM(THREADID threadid, UINT32 regno, PIN_REGISTER* xmm)
 {
     if (!Emit(threadid))
         return;
-    out << "\t\t\tXMM" << dec << regno << " := " << setfill('0') << hex;
-    out.unsetf(ios::showbase);
-    for(int i=0;i<16;i++) {
-        if (i==4 || i==8 || i==12)
-            out << "_";
-        out << setw(2) << (int)xmm->byte[15-i]; // msb on the left as in registers
-    }
-    out  << setfill(' ') << endl;
-    out.setf(ios::showbase);
+    formatter.Xmm(regno, xmm->byte);
     Flush();
 }
 
+VOID BinaryEmitXMM(THREADID threadid, UINT32 regno, PIN_REGISTER* xmm)
+{
+    if (!Emit(threadid))
+        return;
+
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + sizeof(UINT32) + 16);
+    p = Put(p, static_cast<UINT8>(DT_XMM));
+    p = Put(p, regno);
+    memcpy(p, xmm->byte, 16);
+    buf->Commit(p + 16);
+}
+
 VOID AddXMMEmit(INS ins, IPOINT point, REG xmm_dst)
 {
-    INS_InsertCall(ins, point, AFUNPTR(EmitXMM), IARG_THREAD_ID,
+    INS_InsertCall(ins, point, KnobBinary ? AFUNPTR(BinaryEmitXMM) : AFUNPTR(EmitXMM), IARG_THREAD_ID,
                    IARG_UINT32, xmm_dst - REG_XMM0,
                    IARG_REG_CONST_REFERENCE, xmm_dst,
                    IARG_END);
@@ -266,6 +523,22 @@ VOID AddEmit(INS ins, IPOINT point, string & traceString, UINT32 regCount, REG r
     if (regCount > MaxEmitArgs)
         regCount = MaxEmitArgs;
 
+    if (KnobBinary)
+    {
+        IARGLIST args = IARGLIST_Alloc();
+        for (UINT32 i = 0; i < regCount; i++)
+        {
+            IARGLIST_AddArguments(args, IARG_REG_VALUE, regs[i], IARG_END);
+        }
+
+        INS_InsertCall(ins, point, binaryEmitFuns[regCount], IARG_THREAD_ID,
+                       IARG_UINT32, NewIns(traceString, regCount, regs),
+                       IARG_IARGLIST, args,
+                       IARG_END);
+        IARGLIST_Free(args);
+        return;
+    }
+
     IARGLIST args = IARGLIST_Alloc();
     for (UINT32 i = 0; i < regCount; i++)
     {
@@ -286,88 +559,45 @@ VOID CaptureWriteEa(THREADID threadid, VOID * addr)
     WriteEa[threadid] = addr;
 }
 
-VOID ShowN(UINT32 n, VOID *ea)
+// Copy the memory operand, for the text trace into a local buffer, for
+// the binary trace straight into the record.
+LOCALFUN VOID EmitMemory(THREADID threadid, DT_RECORD type, VOID * ea, UINT32 size)
 {
-    out.unsetf(ios::showbase);
-    // Print out the bytes in "big endian even though they are in memory little endian.
-    // This is most natural for 8B and 16B quantities that show up most frequently.
-    // The address pointed to
-    out << std::setfill('0');
+    if (KnobBinary)
+    {
+        THREAD_BUFFER * buf = Buffer(threadid);
+        UINT8 * p = buf->Reserve(1 + sizeof(ADDRINT) + sizeof(UINT32) + size);
+        p = Put(p, static_cast<UINT8>(type));
+        p = Put(p, reinterpret_cast<ADDRINT>(ea));
+        p = Put(p, size);
+        PIN_SafeCopy(p, static_cast<UINT8*>(ea), size);
+        buf->Commit(p + size);
+        return;
+    }
+
     UINT8 b[512];
     UINT8* x;
-    if (n > 512)
-        x = new UINT8[n];
+    if (size > 512)
+        x = new UINT8[size];
     else
         x = b;
-    PIN_SafeCopy(x,static_cast<UINT8*>(ea),n);
-    for (UINT32 i = 0; i < n; i++)
-    {
-        out << std::setw(2) <<  static_cast<UINT32>(x[n-i-1]);
-        if (((reinterpret_cast<ADDRINT>(ea)+n-i-1)&0x3)==0 && i<n-1)
-            out << "_";
-    }
-    out << std::setfill(' ');
-    out.setf(ios::showbase);
-    if (n>512)
+    PIN_SafeCopy(x, static_cast<UINT8*>(ea), size);
+    if (type == DT_WRITE)
+        formatter.Write(reinterpret_cast<ADDRINT>(ea), size, x);
+    else
+        formatter.Read(reinterpret_cast<ADDRINT>(ea), size, x);
+    if (size > 512)
         delete [] x;
-}
 
+    Flush();
+}
 
 VOID EmitWrite(THREADID threadid, UINT32 size)
 {
     if (!Emit(threadid))
         return;
 
-    out << "                                 Write ";
-
-    VOID * ea = WriteEa[threadid];
-
-    switch(size)
-    {
-      case 0:
-        out << "0 repeat count" << endl;
-        break;
-
-      case 1:
-        {
-            UINT8 x;
-            PIN_SafeCopy(&x, static_cast<UINT8*>(ea), 1);
-            out << "*(UINT8*)" << ea << " = " << static_cast<UINT32>(x) << endl;
-        }
-        break;
-
-      case 2:
-        {
-            UINT16 x;
-            PIN_SafeCopy(&x, static_cast<UINT16*>(ea), 2);
-            out << "*(UINT16*)" << ea << " = " << x << endl;
-        }
-        break;
-
-      case 4:
-        {
-            UINT32 x;
-            PIN_SafeCopy(&x, static_cast<UINT32*>(ea), 4);
-            out << "*(UINT32*)" << ea << " = " << x << endl;
-        }
-        break;
-
-      case 8:
-        {
-            UINT64 x;
-            PIN_SafeCopy(&x, static_cast<UINT64*>(ea), 8);
-            out << "*(UINT64*)" << ea << " = " << x << endl;
-        }
-        break;
-
-      default:
-        out << "*(UINT" << dec << size * 8 << hex << ")" << ea << " = ";
-        ShowN(size,ea);
-        out << endl;
-        break;
-    }
-
-    Flush();
+    EmitMemory(threadid, DT_WRITE, WriteEa[threadid], size);
 }
 
 VOID EmitRead(THREADID threadid, VOID * ea, UINT32 size)
@@ -375,90 +605,34 @@ VOID EmitRead(THREADID threadid, VOID * ea, UINT32 size)
     if (!Emit(threadid))
         return;
 
-    out << "                                 Read ";
-
-    switch(size)
-    {
-      case 0:
-        out << "0 repeat count" << endl;
-        break;
-
-      case 1:
-        {
-            UINT8 x;
-            PIN_SafeCopy(&x,static_cast<UINT8*>(ea),1);
-            out << static_cast<UINT32>(x) << " = *(UINT8*)" << ea << endl;
-        }
-        break;
-
-      case 2:
-        {
-            UINT16 x;
-            PIN_SafeCopy(&x,static_cast<UINT16*>(ea),2);
-            out << x << " = *(UINT16*)" << ea << endl;
-        }
-        break;
-
-      case 4:
-        {
-            UINT32 x;
-            PIN_SafeCopy(&x,static_cast<UINT32*>(ea),4);
-            out << x << " = *(UINT32*)" << ea << endl;
-        }
-        break;
-
-      case 8:
-        {
-            UINT64 x;
-            PIN_SafeCopy(&x,static_cast<UINT64*>(ea),8);
-            out << x << " = *(UINT64*)" << ea << endl;
-        }
-        break;
-
-      default:
-        ShowN(size,ea);
-        out << " = *(UINT" << dec << size * 8 << hex << ")" << ea << endl;
-        break;
-    }
-
-    Flush();
+    EmitMemory(threadid, DT_READ, ea, size);
 }
 
 
-LOCALVAR INT32 indent = 0;
-
-VOID Indent()
-{
-    for (INT32 i = 0; i < indent; i++)
-    {
-        out << "| ";
-    }
-}
-
-VOID EmitICount()
-{
-    out << setw(10) << dec << icount.Count() << hex << " ";
-}
-
 VOID EmitDirectCall(THREADID threadid, string * str, INT32 tailCall, ADDRINT arg0, ADDRINT arg1)
 {
     if (!Emit(threadid))
         return;
 
-    EmitICount();
-
-    if (tailCall)
-    {
-        // A tail call is like an implicit return followed by an immediate call
-        indent--;
-    }
+    formatter.DirectCall(icount.Count(), *str, tailCall, arg0, arg1);
 
-    Indent();
-    out << *str << "(" << arg0 << ", " << arg1 << ", ...)" << endl;
+    Flush();
+}
 
-    indent++;
+VOID BinaryEmitDirectCall(THREADID threadid, UINT32 str, INT32 tailCall, ADDRINT arg0, ADDRINT arg1)
+{
+    if (!Emit(threadid))
+        return;
 
-    Flush();
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + 2*sizeof(UINT32) + sizeof(UINT64) + 2*sizeof(ADDRINT));
+    p = Put(p, static_cast<UINT8>(DT_DIRECT_CALL));
+    p = Put(p, str);
+    p = Put(p, static_cast<UINT32>(tailCall));
+    p = Put(p, static_cast<UINT64>(icount.Count()));
+    p = Put(p, arg0);
+    p = Put(p, arg1);
+    buf->Commit(p);
 }
 
 string FormatAddress(ADDRINT address, RTN rtn)
@@ -503,41 +677,83 @@ VOID EmitIndirectCall(THREADID threadid, string * str, ADDRINT target, ADDRINT a
     if (!Emit(threadid))
         return;
 
-    EmitICount();
-    Indent();
-    out << *str;
-
     PIN_LockClient();
 
     string s = FormatAddress(target, RTN_FindByAddress(target));
 
     PIN_UnlockClient();
 
-    out << s << "(" << arg0 << ", " << arg1 << ", ...)" << endl;
-    indent++;
+    formatter.IndirectCall(icount.Count(), *str, s, arg0, arg1);
 
     Flush();
 }
 
-VOID EmitReturn(THREADID threadid, string * str, ADDRINT ret0)
+// The formatted target of an indirect call. Each target is only formatted
+// once; the file lock is not held while we take the client lock, since
+// instrumentation takes them in the opposite order.
+LOCALFUN UINT32 TargetString(THREADID threadid, ADDRINT target)
+{
+    PIN_GetLock(&fileLock, threadid+1);
+    map<ADDRINT, UINT32>::iterator it = targetStringIds.find(target);
+    BOOL found = (it != targetStringIds.end());
+    UINT32 id = found ? it->second : 0;
+    PIN_ReleaseLock(&fileLock);
+    if (found)
+        return id;
+
+    PIN_LockClient();
+    string s = FormatAddress(target, RTN_FindByAddress(target));
+    PIN_UnlockClient();
+
+    id = NewString(s);
+    PIN_GetLock(&fileLock, threadid+1);
+    targetStringIds[target] = id;
+    PIN_ReleaseLock(&fileLock);
+    return id;
+}
+
+VOID BinaryEmitIndirectCall(THREADID threadid, UINT32 str, ADDRINT target, ADDRINT arg0, ADDRINT arg1)
 {
     if (!Emit(threadid))
         return;
 
-    EmitICount();
-    indent--;
-    if (indent < 0)
-    {
-        out << "@@@ return underflow\n";
-        indent = 0;
-    }
+    UINT32 targetStr = TargetString(threadid, target);
+
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + 2*sizeof(UINT32) + sizeof(UINT64) + 2*sizeof(ADDRINT));
+    p = Put(p, static_cast<UINT8>(DT_INDIRECT_CALL));
+    p = Put(p, str);
+    p = Put(p, targetStr);
+    p = Put(p, static_cast<UINT64>(icount.Count()));
+    p = Put(p, arg0);
+    p = Put(p, arg1);
+    buf->Commit(p);
+}
 
-    Indent();
-    out << *str << " returns: " << ret0 << endl;
+VOID EmitReturn(THREADID threadid, string * str, ADDRINT ret0)
+{
+    if (!Emit(threadid))
+        return;
+
+    formatter.Return(icount.Count(), *str, ret0);
 
     Flush();
 }
 
+VOID BinaryEmitReturn(THREADID threadid, UINT32 str, ADDRINT ret0)
+{
+    if (!Emit(threadid))
+        return;
+
+    THREAD_BUFFER * buf = Buffer(threadid);
+    UINT8 * p = buf->Reserve(1 + sizeof(UINT32) + sizeof(UINT64) + sizeof(ADDRINT));
+    p = Put(p, static_cast<UINT8>(DT_RETURN));
+    p = Put(p, str);
+    p = Put(p, static_cast<UINT64>(icount.Count()));
+    p = Put(p, ret0);
+    buf->Commit(p);
+}
+
 
 VOID CallTrace(TRACE trace, INS ins)
 {
@@ -550,9 +766,13 @@ VOID CallTrace(TRACE trace, INS ins)
         string s = "Call " + FormatAddress(INS_Address(ins), TRACE_Rtn(trace));
         s += " -> ";
 
-        INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(EmitIndirectCall), IARG_THREAD_ID,
-                       IARG_PTR, new string(s), IARG_BRANCH_TARGET_ADDR,
+        IARGLIST str = IARGLIST_Alloc();
+        AddStringArgument(str, s);
+        INS_InsertCall(ins, IPOINT_BEFORE,
+                       KnobBinary ? AFUNPTR(BinaryEmitIndirectCall) : AFUNPTR(EmitIndirectCall), IARG_THREAD_ID,
+                       IARG_IARGLIST, str, IARG_BRANCH_TARGET_ADDR,
                        IARG_G_ARG0_CALLER, IARG_G_ARG1_CALLER, IARG_END);
+        IARGLIST_Free(str);
     }
     else if (INS_IsDirectBranchOrCall(ins))
     {
@@ -592,9 +812,13 @@ VOID CallTrace(TRACE trace, INS ins)
 
             s += FormatAddress(target, RTN_FindByAddress(target));
 
-            INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(EmitDirectCall),
-                           IARG_THREAD_ID, IARG_PTR, new string(s), IARG_BOOL, tailcall,
+            IARGLIST str = IARGLIST_Alloc();
+            AddStringArgument(str, s);
+            INS_InsertCall(ins, IPOINT_BEFORE,
+                           KnobBinary ? AFUNPTR(BinaryEmitDirectCall) : AFUNPTR(EmitDirectCall),
+                           IARG_THREAD_ID, IARG_IARGLIST, str, IARG_BOOL, tailcall,
                            IARG_G_ARG0_CALLER, IARG_G_ARG1_CALLER, IARG_END);
+            IARGLIST_Free(str);
         }
     }
     else if (INS_IsRet(ins))
@@ -606,8 +830,11 @@ VOID CallTrace(TRACE trace, INS ins)
         if( RTN_Valid(rtn) && RTN_Name(rtn) ==  "_dl_runtime_resolve") return;
 #endif
         string tracestring = "Return " + FormatAddress(INS_Address(ins), rtn);
-        INS_InsertCall(ins, IPOINT_BEFORE, AFUNPTR(EmitReturn),
-                       IARG_THREAD_ID, IARG_PTR, new string(tracestring), IARG_G_RESULT0, IARG_END);
+        IARGLIST str = IARGLIST_Alloc();
+        AddStringArgument(str, tracestring);
+        INS_InsertCall(ins, IPOINT_BEFORE, KnobBinary ? AFUNPTR(BinaryEmitReturn) : AFUNPTR(EmitReturn),
+                       IARG_THREAD_ID, IARG_IARGLIST, str, IARG_G_RESULT0, IARG_END);
+        IARGLIST_Free(str);
     }
 }
 
@@ -709,6 +936,31 @@ VOID MemoryTrace(INS ins)
 }
 
 
+// Record the events that would be traced in the flight recorder instead.
+VOID FlightRecorderTrace(INS ins)
+{
+    if (KnobTraceInstructions)
+        recorder.Insert(ins, FLIGHT_INS);
+
+    if (KnobTraceCalls)
+    {
+        if (INS_IsCall(ins))
+            recorder.Insert(ins, FLIGHT_CALL, IARG_BRANCH_TARGET_ADDR);
+        else if (INS_IsRet(ins))
+            recorder.Insert(ins, FLIGHT_RETURN, IARG_BRANCH_TARGET_ADDR);
+    }
+
+    if (KnobTraceMemory && INS_IsStandardMemop(ins))
+    {
+        if (INS_IsMemoryRead(ins) && !INS_IsPrefetch(ins))
+            recorder.Insert(ins, FLIGHT_READ, IARG_MEMORYREAD_EA);
+        if (INS_HasMemoryRead2(ins))
+            recorder.Insert(ins, FLIGHT_READ, IARG_MEMORYREAD2_EA);
+        if (INS_IsMemoryWrite(ins))
+            recorder.Insert(ins, FLIGHT_WRITE, IARG_MEMORYWRITE_EA);
+    }
+}
+
 /* ===================================================================== */
 
 VOID Trace(TRACE trace, VOID *v)
@@ -722,6 +974,12 @@ VOID Trace(TRACE trace, VOID *v)
         {
             for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
             {
+                if (recorder.IsActive())
+                {
+                    FlightRecorderTrace(ins);
+                    continue;
+                }
+
                 InstructionTrace(trace, ins);
 
                 CallTrace(trace, ins);
@@ -735,9 +993,30 @@ VOID Trace(TRACE trace, VOID *v)
 
 /* ===================================================================== */
 
+VOID ThreadFini(THREADID threadid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    FlushBuffer(threadid);
+    delete buffers[threadid];
+    buffers[threadid] = 0;
+}
+
 VOID Fini(int, VOID * v)
 {
-    out << "# $eof" <<  endl;
+    if (KnobBinary)
+    {
+        for (THREADID i = 0; i < PIN_MAX_THREADS; i++)
+            FlushBuffer(i);
+        WriteText("# $eof\n");
+    }
+    else
+    {
+        if (recorder.IsActive())
+        {
+            recorder.Dump(out, "end of program");
+            recorder.Release();
+        }
+        out << "# $eof" <<  endl;
+    }
 
     out.close();
 }
@@ -753,6 +1032,12 @@ static void OnSig(THREADID threadIndex,
                   INT32 sig,
                   VOID *v)
 {
+    // The binary trace keeps the line in the order of this thread's records.
+    ostringstream text;
+    text << hex << right;
+    text.setf(ios::showbase);
+    ostream & out = KnobBinary ? static_cast<ostream &>(text) : static_cast<ostream &>(::out);
+
     if (ctxtFrom != 0)
     {
         ADDRINT address = PIN_GetContextReg(ctxtFrom, REG_INST_PTR);
@@ -788,6 +1073,32 @@ static void OnSig(THREADID threadIndex,
         break;
     }
     out << std::endl;
+
+    if (KnobBinary)
+    {
+        const string line = text.str();
+        THREAD_BUFFER * buf = Buffer(threadIndex);
+        UINT8 * p = buf->Reserve(1 + sizeof(UINT32) + line.size());
+        p = Put(p, static_cast<UINT8>(DT_TEXT));
+        p = Put(p, static_cast<UINT32>(line.size()));
+        memcpy(p, line.data(), line.size());
+        buf->Commit(p + line.size());
+
+        // The application might not survive this signal.
+        if (reason == CONTEXT_CHANGE_REASON_FATALSIGNAL)
+        {
+            buf->Flush();
+            PIN_GetLock(&fileLock, threadIndex+1);
+            ::out.flush();
+            PIN_ReleaseLock(&fileLock);
+        }
+    }
+
+    if (recorder.IsActive()
+        && (reason == CONTEXT_CHANGE_REASON_FATALSIGNAL || reason == CONTEXT_CHANGE_REASON_EXCEPTION))
+    {
+        recorder.Dump(out, "signal " + decstr(sig) + " on thread " + decstr(threadIndex), threadIndex);
+    }
 }
 
 /* ===================================================================== */
@@ -813,10 +1124,30 @@ int main(int argc, CHAR *argv[])
         filename += "." + decstr(getpid());
     }
 
+    if (KnobFlightRecorder && KnobBinary)
+    {
+        cerr << "-flight_recorder and -binary cannot be used together" << endl;
+        return 1;
+    }
+    if (KnobFlightRecorder)
+        recorder.Activate(KnobFlightRecorder);
+
     // Do this before we activate controllers
-    out.open(filename.c_str());
-    out << hex << right;
-    out.setf(ios::showbase);
+    if (KnobBinary)
+    {
+        PIN_InitLock(&fileLock);
+        out.open(filename.c_str(), ios::out | ios::binary);
+        UINT32 addrSize = sizeof(ADDRINT);
+        out.write(DEBUGTRACE_MAGIC, 8);
+        out.write(reinterpret_cast<const char *>(&addrSize), sizeof(addrSize));
+        PIN_AddThreadFiniFunction(ThreadFini, 0);
+    }
+    else
+    {
+        out.open(filename.c_str());
+        out << hex << right;
+        out.setf(ios::showbase);
+    }
 
     control.RegisterHandler(Handler, 0, FALSE);
     control.Activate();
@@ -63,6 +63,7 @@ volatile unsigned Max = 10;
 
 static void GenerateBreakpointScripts(const char *, const char *);
 static void GenerateTracepointScripts(const char *, const char *);
+static void GenerateCheckpointScripts(const char *, const char *);
 static void RunTest();
 extern "C" unsigned AssemblyReturn(unsigned);
 extern "C" char Label_WriteAx;
@@ -89,6 +90,11 @@ int main(int argc, char **argv)
         GenerateTracepointScripts(argv[2], argv[3]);
         return 0;
     }
+    if (argc == 4 && strcmp(argv[1], "checkpoints") == 0)
+    {
+        GenerateCheckpointScripts(argv[2], argv[3]);
+        return 0;
+    }
 
     // When run with no arguments, execute the test code.
     //
@@ -276,3 +282,47 @@ static void GenerateTracepointScripts(const char *inFile, const char *compareFil
 
     in << "quit\n";
 }
+
+
+static void GenerateCheckpointScripts(const char *inFile, const char *compareFile)
+{
+    std::ofstream in(inFile);
+    std::ofstream compare(compareFile);
+
+    // The application's fork() is only known once libc is loaded, so start
+    // taking checkpoints in main().  Taking one every 2 instructions between
+    // main() and RunTest() gives more checkpoints than the limit.
+    //
+    in << "break main\n";
+    in << "cont\n";        /* stop at main */
+    in << "monitor checkpoint limit 2\n";
+    in << "monitor checkpoint every 2\n";
+    in << "break RunTest\n";
+    in << "cont\n";        /* stop at RunTest */
+    in << "monitor checkpoint every 0\n";
+    in << "monitor list checkpoints\n";
+
+    compare << "Breakpoint 1,\\s*main\n";
+    compare << "Keep at most 2 checkpoints\n";
+    compare << "Checkpoint thread 0 every 2 instructions\n";
+    compare << "Breakpoint 2,\\s*RunTest\n";
+    compare << "Stopped taking checkpoints\n";
+    compare << "#[0-9]+:\\s+thread 0 icount [0-9]+ \\(pid [0-9]+\\)\n";
+    compare << "#[0-9]+:\\s+thread 0 icount [0-9]+ \\(pid [0-9]+\\)\n";
+    compare << "[0-9]+ checkpoints discarded to keep at most 2\n";
+
+    // The first checkpoint was taken in main(), well after icount 0, and has been
+    // discarded anyway.  Restarting far past the end of the program resumes the
+    // newest checkpoint, which then runs to completion without stopping.
+    //
+    in << "monitor restart at icount 0\n";
+    in << "monitor restart at icount 1000000000000\n";
+    in << "monitor list checkpoints\n";
+    in << "cont\n";        /* program terminates */
+    in << "quit\n";
+
+    compare << "No checkpoint at or before icount 0\n";
+    compare << "Restarted checkpoint #[0-9]+ \\(icount [0-9]+\\) as process [0-9]+\n";
+    compare << "#[0-9]+:\\s+thread 0 icount [0-9]+ \\(pid [0-9]+\\)\n";
+    compare << "(Program exited normally|\\[Inferior 1 \\(Remote target\\) exited normally\\])\n";
+}
@@ -37,6 +37,7 @@ END_LEGAL */
 
 int main(int argc, char **argv)
 {
+    PIN_InitSymbols();
     if (PIN_Init(argc,argv))
         return 1;
 
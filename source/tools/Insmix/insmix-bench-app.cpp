@@ -0,0 +1,100 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*! @file
+ *  Benchmark application for insmix. Runs the same small loop in N threads
+ *  and prints the elapsed time, so that the per thread counter slabs can be
+ *  compared against -shared_counters. All the threads execute the same
+ *  blocks, which is the worst case for shared block counters.
+ *
+ *  Usage: insmix-bench-app <threads> <iterations per thread>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static unsigned long iterations = 1000000;
+static volatile unsigned long sink;
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void * Work(void * arg)
+{
+    unsigned long x = (unsigned long)arg + 1;
+    unsigned long sum = 0;
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        // a few short blocks per iteration
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+        if (x & 0x100)
+            sum += x >> 7;
+        else
+            sum ^= x;
+        if ((x >> 33) % 3 == 0)
+            sum++;
+    }
+    sink += sum;
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    int nthreads = (argc > 1) ? atoi(argv[1]) : 1;
+    if (argc > 2)
+        iterations = strtoul(argv[2], 0, 0);
+    if (nthreads < 1)
+        nthreads = 1;
+
+    pthread_t * threads = new pthread_t[nthreads];
+    double start = Now();
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&threads[i], 0, Work, (void *)(unsigned long)i) != 0)
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], 0);
+    double elapsed = Now() - start;
+
+    printf("threads %d iterations %lu seconds %.3f iterations/s %.0f\n",
+           nthreads, iterations, elapsed, (nthreads * (double)iterations) / elapsed);
+    delete [] threads;
+    return 0;
+}
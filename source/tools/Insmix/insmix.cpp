@@ -43,8 +43,11 @@ END_LEGAL */
 #include <unistd.h>
 #include "pin.H"
 #include "control_manager.H"
+#include "stats_segment.H"
+#include "interval_timer.H"
 
 using namespace CONTROLLER;
+using namespace INSTLIB;
 
 /* ===================================================================== */
 /* Commandline Switches */
@@ -68,14 +71,21 @@ KNOB<BOOL>   KnobNoSharedLibs(KNOB_MODE_WRITEONCE,       "pintool",
     "no_shared_libs", "0", "do not instrument shared libraries");
 KNOB<UINT32> KnobNumInstructions(KNOB_MODE_WRITEONCE,    "pintool",
     "num_instructions", "0", "Maximum instructions before detach (zero means no limit)");
+KNOB<string> KnobStatsFile(KNOB_MODE_WRITEONCE,          "pintool",
+    "stats_file", "", "publish live dynamic counts in this memory mapped file (see InstLib/statsview.py)");
+KNOB<UINT32> KnobStatsInterval(KNOB_MODE_WRITEONCE,      "pintool",
+    "stats_interval", "1000", "milliseconds between updates of the -stats_file");
+KNOB<BOOL>   KnobSharedCounters(KNOB_MODE_WRITEONCE,     "pintool",
+    "shared_counters", "0", "count into process wide block counters instead of per thread slabs");
 
 LOCALFUN string longstr(int rtn_no, const char *name) {return string("rtn[") + decstr(rtn_no) + string(",") + string(name) + string("]");}
 
-// The running count of instructions is kept here
+// The running count of instructions is kept here. With per thread slabs
+// it only holds the counts of the threads that have exited.
 // make it static to help the compiler optimize count_instructions
 static UINT64 inscount = 0;
 
-// This function is called before every block
+// This function is called before every block (-shared_counters only)
 VOID count_instructions(UINT32 c) { inscount += c; }
 
 /* ===================================================================== */
@@ -267,10 +277,11 @@ class BBLSTATS
     const UINT32 _rtn_num;
     const UINT32 _size;
     const UINT32 _numins;
+    const UINT32 _id; // dense index into the thread slabs
 
   public:
-    BBLSTATS(UINT16 * stats, ADDRINT addr, UINT32 rtn_num, UINT32 size, UINT32 numins ) :
-        _counter(0), _stats(stats), _addr(addr), _rtn_num(rtn_num), _size(size),_numins(numins)  {};
+    BBLSTATS(UINT16 * stats, ADDRINT addr, UINT32 rtn_num, UINT32 size, UINT32 numins, UINT32 id ) :
+        _counter(0), _stats(stats), _addr(addr), _rtn_num(rtn_num), _size(size),_numins(numins), _id(id)  {};
 
 };
 
@@ -283,6 +294,170 @@ LOCALFUN BOOL CompareLess(const BBLSTATS * const & s1 , const BBLSTATS *const &
 
 LOCALVAR vector<const BBLSTATS*> statsList;
 
+// Blocks indexed by their _id. Unlike statsList this is never sorted.
+LOCALVAR vector<BBLSTATS*> blocksById;
+
+/* ===================================================================== */
+/* Thread slabs */
+/* ===================================================================== */
+
+// Each thread counts into its own slab, so the application threads never
+// write to a shared cache line. The counters are folded into the
+// BBLSTATS when the thread exits (or at Fini/detach for the threads that
+// are still running).
+const UINT32 CACHE_LINE_COUNTERS = 64 / sizeof(COUNTER);
+
+class THREAD_SLAB
+{
+  private:
+    char _pad0[64];
+
+  public:
+    COUNTER * counts;          // indexed by BBLSTATS::_id
+    UINT32 size;
+    COUNTER inscount;
+    COUNTER * predicated_true; // indexed by opcode, only with -p
+
+  private:
+    char _pad1[64];
+
+    // A cache line of padding on either side keeps other allocations off
+    // the lines that hold the counters.
+    static COUNTER * Allocate(UINT32 n)
+    {
+        COUNTER * a = new COUNTER[n + 2 * CACHE_LINE_COUNTERS];
+        memset(a, 0, (n + 2 * CACHE_LINE_COUNTERS) * sizeof(COUNTER));
+        return a + CACHE_LINE_COUNTERS;
+    }
+    static VOID Free(COUNTER * a)
+    {
+        if (a)
+            delete [] (a - CACHE_LINE_COUNTERS);
+    }
+
+  public:
+    THREAD_SLAB(UINT32 n, BOOL predicated) : size(n), inscount(0), predicated_true(0)
+    {
+        counts = Allocate(n);
+        if (predicated)
+            predicated_true = Allocate(MAX_INDEX);
+    }
+    ~THREAD_SLAB()
+    {
+        Free(counts);
+        Free(predicated_true);
+    }
+
+    // Called by the owning thread only, with slabsLock held so that the
+    // other readers never see the old array after it is freed.
+    VOID Grow(UINT32 n)
+    {
+        UINT32 newSize = max(2 * size, n);
+        COUNTER * a = Allocate(newSize);
+        memcpy(a, counts, size * sizeof(COUNTER));
+        Free(counts);
+        counts = a;
+        size = newSize;
+    }
+};
+
+LOCALVAR REG slabReg;
+LOCALVAR PIN_LOCK slabsLock;
+LOCALVAR vector<THREAD_SLAB *> slabs(PIN_MAX_THREADS, 0); // live slabs, by thread id
+
+LOCALFUN VOID ThreadStart(THREADID tid, CONTEXT * ctxt, INT32 flags, VOID * v)
+{
+    PIN_LockClient();
+    THREAD_SLAB * slab = new THREAD_SLAB(max(blocksById.size(), size_t(1024)), KnobProfilePredicated.Value());
+    PIN_UnlockClient();
+
+    PIN_GetLock(&slabsLock, tid + 1);
+    slabs[tid] = slab;
+    PIN_ReleaseLock(&slabsLock);
+
+    PIN_SetContextReg(ctxt, slabReg, reinterpret_cast<ADDRINT>(slab));
+}
+
+// Fold a slab into the block counters. Called with the client lock and
+// slabsLock held.
+LOCALFUN VOID MergeSlab(THREAD_SLAB * slab)
+{
+    const UINT32 n = min(slab->size, UINT32(blocksById.size()));
+    for (UINT32 i = 0; i < n; i++)
+        blocksById[i]->_counter += slab->counts[i];
+    if (slab->predicated_true)
+    {
+        for (UINT32 i = 0; i < MAX_INDEX; i++)
+            GlobalStatsDynamic.predicated_true[i] += slab->predicated_true[i];
+    }
+    inscount += slab->inscount;
+}
+
+LOCALFUN VOID ThreadFini(THREADID tid, const CONTEXT * ctxt, INT32 code, VOID * v)
+{
+    PIN_LockClient();
+    PIN_GetLock(&slabsLock, tid + 1);
+    THREAD_SLAB * slab = slabs[tid];
+    slabs[tid] = 0;
+    if (slab)
+        MergeSlab(slab);
+    PIN_ReleaseLock(&slabsLock);
+    PIN_UnlockClient();
+    delete slab;
+}
+
+// Fold the slabs of the threads that are still running. After this the
+// slabs are gone, so this is only called when counting ends.
+LOCALFUN VOID MergeLiveSlabs()
+{
+    PIN_LockClient();
+    PIN_GetLock(&slabsLock, 1);
+    for (UINT32 tid = 0; tid < slabs.size(); tid++)
+    {
+        if (slabs[tid] == 0)
+            continue;
+        MergeSlab(slabs[tid]);
+        // the thread may still run (after detach) so the slab is leaked
+        slabs[tid] = 0;
+    }
+    PIN_ReleaseLock(&slabsLock);
+    PIN_UnlockClient();
+}
+
+// The instructions executed so far by all threads.
+LOCALFUN UINT64 TotalInsCount()
+{
+    UINT64 total = inscount;
+    PIN_GetLock(&slabsLock, 1);
+    for (UINT32 tid = 0; tid < slabs.size(); tid++)
+    {
+        if (slabs[tid])
+            total += slabs[tid]->inscount;
+    }
+    PIN_ReleaseLock(&slabsLock);
+    return total;
+}
+
+// The block counts so far, by block id. Called with the client lock held.
+LOCALFUN VOID SumBlockCounts(vector<COUNTER>& totals)
+{
+    totals.resize(blocksById.size());
+    for (UINT32 i = 0; i < blocksById.size(); i++)
+        totals[i] = blocksById[i]->_counter;
+
+    PIN_GetLock(&slabsLock, 1);
+    for (UINT32 tid = 0; tid < slabs.size(); tid++)
+    {
+        const THREAD_SLAB * slab = slabs[tid];
+        if (slab == 0)
+            continue;
+        const UINT32 n = min(slab->size, UINT32(totals.size()));
+        for (UINT32 i = 0; i < n; i++)
+            totals[i] += slab->counts[i];
+    }
+    PIN_ReleaseLock(&slabsLock);
+}
+
 /* ===================================================================== */
 
 LOCALVAR UINT32 enabled = 0;
@@ -309,12 +484,116 @@ LOCALFUN VOID Handler(EVENT_TYPE ev, VOID *, CONTEXT *, VOID *, THREADID, bool b
 LOCALVAR CONTROL_MANAGER control;
 
 
+/* ===================================================================== */
+/* Live stats */
+/* ===================================================================== */
+
+// The dynamic counts are folded from the block counters into the stats
+// segment by an internal thread, so the application threads only ever
+// increment their block counters. The slot holds the sum over all
+// threads.
+LOCALVAR STATS_SEGMENT statsSegment;
+LOCALVAR vector<UINT32> statsSegmentIndex(MAX_INDEX, ~0U); // stat index -> segment counter
+LOCALVAR vector<UINT64> statsSegmentCounts;
+LOCALVAR vector<COUNTER> statsBlockCounts;
+LOCALVAR PIN_THREAD_UID statsThreadUid;
+LOCALVAR volatile BOOL statsThreadStop = FALSE;
+
+LOCALFUN BOOL OpenStatsSegment()
+{
+    vector<string> names;
+    names.push_back(IndexToOpcodeString(INDEX_TOTAL));
+    statsSegmentIndex[INDEX_TOTAL] = 0;
+    for (UINT32 i = 1; i < XED_ICLASS_LAST; i++)
+    {
+        statsSegmentIndex[i] = names.size();
+        names.push_back(IndexToOpcodeString(i));
+    }
+    for (UINT32 i = INDEX_TOTAL + 1; i < INDEX_SPECIAL_END; i++)
+    {
+        statsSegmentIndex[i] = names.size();
+        names.push_back(IndexToOpcodeString(i));
+    }
+    statsSegmentCounts.resize(names.size());
+    return statsSegment.Open(KnobStatsFile.Value(), 1, names);
+}
+
+LOCALFUN VOID PublishStats()
+{
+    std::fill(statsSegmentCounts.begin(), statsSegmentCounts.end(), 0);
+    COUNTER total = 0;
+
+    // blocksById grows during instrumentation
+    PIN_LockClient();
+    SumBlockCounts(statsBlockCounts);
+    for (UINT32 i = 0; i < statsBlockCounts.size(); i++)
+    {
+        const BBLSTATS *b = blocksById[i];
+        const COUNTER count = statsBlockCounts[i];
+        if (count == 0) continue;
+        for (const UINT16 * stats = b->_stats; *stats; stats++)
+        {
+            UINT32 c = statsSegmentIndex[*stats];
+            if (c != ~0U)
+                statsSegmentCounts[c] += count;
+            if (*stats < INDEX_SPECIAL)
+                total += count;
+        }
+    }
+    PIN_UnlockClient();
+
+    statsSegmentCounts[statsSegmentIndex[INDEX_TOTAL]] = total;
+    statsSegment.Publish(0, 0, &statsSegmentCounts[0]);
+}
+
+LOCALFUN VOID StatsThread(VOID *)
+{
+    INTERVAL_TIMER timer(KnobStatsInterval.Value());
+    while (timer.Wait(&statsThreadStop))
+        PublishStats();
+}
+
+// Called before Fini and on detach. Publishes the final counts.
+LOCALFUN VOID StopStatsThread(VOID *)
+{
+    if (!statsSegment.Valid() || statsThreadStop)
+        return;
+    statsThreadStop = TRUE;
+    PIN_WaitForThreadTermination(statsThreadUid, PIN_INFINITE_TIMEOUT, 0);
+    PublishStats();
+}
+
 /* ===================================================================== */
 VOID PIN_FAST_ANALYSIS_CALL docount(COUNTER * counter)
 {
     (*counter) += enabled;
 }
 
+VOID PIN_FAST_ANALYSIS_CALL docount_slab(THREAD_SLAB * slab, UINT32 id, UINT32 numins)
+{
+    slab->counts[id] += enabled;
+    slab->inscount += numins;
+}
+
+VOID PIN_FAST_ANALYSIS_CALL docount_predicated_slab(THREAD_SLAB * slab, UINT32 opcode)
+{
+    slab->predicated_true[opcode] += enabled;
+}
+
+// Called at the head of every trace, so that the blocks of the trace
+// always fit in the slab.
+ADDRINT PIN_FAST_ANALYSIS_CALL SlabTooSmall(THREAD_SLAB * slab, UINT32 last_id)
+{
+    return last_id >= slab->size;
+}
+
+VOID GrowSlab(THREAD_SLAB * slab, UINT32 last_id, THREADID tid)
+{
+    PIN_GetLock(&slabsLock, tid + 1);
+    slab->Grow(last_id + 1);
+    PIN_ReleaseLock(&slabsLock);
+}
+
 /* ===================================================================== */
 
 VOID Trace(TRACE trace, VOID *v)
@@ -323,7 +602,7 @@ VOID Trace(TRACE trace, VOID *v)
          && IMG_Type(SEC_Img(RTN_Sec(TRACE_Rtn(trace)))) == IMG_TYPE_SHAREDLIB)
         return;
 
-    if ( KnobNumInstructions.Value() > 0 && inscount > KnobNumInstructions.Value())
+    if ( KnobNumInstructions.Value() > 0 && TotalInsCount() > KnobNumInstructions.Value())
         PIN_Detach();
 
     RTN rtn = TRACE_Rtn(trace);
@@ -352,11 +631,22 @@ VOID Trace(TRACE trace, VOID *v)
        rtn_table[rtn_num] = rtn_table_entry;
     }
     const BOOL accurate_handling_of_predicates = KnobProfilePredicated.Value();
+    const BOOL shared = KnobSharedCounters.Value();
+
+    if (!shared)
+    {
+        const UINT32 last_id = blocksById.size() + TRACE_NumBbl(trace) - 1;
+        TRACE_InsertIfCall(trace, IPOINT_BEFORE, AFUNPTR(SlabTooSmall), IARG_FAST_ANALYSIS_CALL,
+                           IARG_REG_VALUE, slabReg, IARG_UINT32, last_id, IARG_END);
+        TRACE_InsertThenCall(trace, IPOINT_BEFORE, AFUNPTR(GrowSlab),
+                             IARG_REG_VALUE, slabReg, IARG_UINT32, last_id, IARG_THREAD_ID, IARG_END);
+    }
 
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
     {
         // Insert a call to count_instructions before every bbl, passing the number of instructions
-        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)count_instructions, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        if (shared)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)count_instructions, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
 
         // Summarize the stats for the bbl in a 0 terminated list
         // This is done at instrumentation time
@@ -381,11 +671,19 @@ VOID Trace(TRACE trace, VOID *v)
             // this is expensive and hence disabled by default
             if( INS_IsPredicated(ins) && accurate_handling_of_predicates )
             {
-                INS_InsertPredicatedCall(ins,
-                                         IPOINT_BEFORE,
-                                         AFUNPTR(docount), IARG_FAST_ANALYSIS_CALL,
-                                         IARG_PTR, &(GlobalStatsDynamic.predicated_true[INS_Opcode(ins)]),
-                                         IARG_END);
+                if (shared)
+                    INS_InsertPredicatedCall(ins,
+                                             IPOINT_BEFORE,
+                                             AFUNPTR(docount), IARG_FAST_ANALYSIS_CALL,
+                                             IARG_PTR, &(GlobalStatsDynamic.predicated_true[INS_Opcode(ins)]),
+                                             IARG_END);
+                else
+                    INS_InsertPredicatedCall(ins,
+                                             IPOINT_BEFORE,
+                                             AFUNPTR(docount_predicated_slab), IARG_FAST_ANALYSIS_CALL,
+                                             IARG_REG_VALUE, slabReg,
+                                             IARG_UINT32, INS_Opcode(ins),
+                                             IARG_END);
             }
 
             curr = INS_GenerateIndexString(ins,curr,1);
@@ -397,11 +695,16 @@ VOID Trace(TRACE trace, VOID *v)
         ASSERTX( curr == stats_end );
 
         // Insert instrumentation to count the number of times the bbl is executed
-        BBLSTATS * bblstats = new BBLSTATS(stats, INS_Address(BBL_InsHead(bbl)), rtn_num, size, numins );
-        INS_InsertCall(BBL_InsHead(bbl), IPOINT_BEFORE, AFUNPTR(docount), IARG_FAST_ANALYSIS_CALL, IARG_PTR, &(bblstats->_counter), IARG_END);
+        BBLSTATS * bblstats = new BBLSTATS(stats, INS_Address(BBL_InsHead(bbl)), rtn_num, size, numins, blocksById.size() );
+        if (shared)
+            INS_InsertCall(BBL_InsHead(bbl), IPOINT_BEFORE, AFUNPTR(docount), IARG_FAST_ANALYSIS_CALL, IARG_PTR, &(bblstats->_counter), IARG_END);
+        else
+            INS_InsertCall(BBL_InsHead(bbl), IPOINT_BEFORE, AFUNPTR(docount_slab), IARG_FAST_ANALYSIS_CALL,
+                           IARG_REG_VALUE, slabReg, IARG_UINT32, bblstats->_id, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
 
         // Remember the counter and stats so we can compute a summary at the end
         statsList.push_back(bblstats);
+        blocksById.push_back(bblstats);
     }
 
 }
@@ -558,6 +861,7 @@ VOID PrintOutput()
 
 VOID Fini(int, VOID * v)
 {
+    MergeLiveSlabs();
     PrintOutput();
 }
 
@@ -565,6 +869,8 @@ VOID Fini(int, VOID * v)
 
 VOID Detach(VOID * v)
 {
+    StopStatsThread(0);
+    MergeLiveSlabs();
     PrintOutput();
 }
 
@@ -621,6 +927,20 @@ int main(int argc, CHAR *argv[])
 
     control.RegisterHandler(Handler, 0, FALSE);
     control.Activate();
+
+    if (!KnobSharedCounters.Value())
+    {
+        slabReg = PIN_ClaimToolRegister();
+        if (!REG_valid(slabReg))
+        {
+            cerr << "insmix: cannot allocate a scratch register" << endl;
+            return 1;
+        }
+        PIN_InitLock(&slabsLock);
+        PIN_AddThreadStartFunction(ThreadStart, 0);
+        PIN_AddThreadFiniFunction(ThreadFini, 0);
+    }
+
     TRACE_AddInstrumentFunction(Trace, 0);
 
     PIN_AddFiniFunction(Fini, 0);
@@ -629,6 +949,21 @@ int main(int argc, CHAR *argv[])
     if( !KnobProfileDynamicOnly.Value() )
         IMG_AddInstrumentFunction(Image, 0);
 
+    if (!KnobStatsFile.Value().empty())
+    {
+        if (!OpenStatsSegment())
+        {
+            cerr << "insmix: cannot create stats file " << KnobStatsFile.Value() << endl;
+            return 1;
+        }
+        if (PIN_SpawnInternalThread(StatsThread, 0, 0, &statsThreadUid) == INVALID_THREADID)
+        {
+            cerr << "insmix: cannot start the stats thread" << endl;
+            return 1;
+        }
+        PIN_AddPrepareForFiniFunction(StopStatsThread, 0);
+    }
+
     // Never returns
 
     PIN_StartProgram();
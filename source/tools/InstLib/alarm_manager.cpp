@@ -295,6 +295,131 @@ VOID ALARM_MANAGER::Disarm(THREADID tid){
     }
 }
 
+ALARM_MANAGER::ADDRESS_ALARM_INDEX& ALARM_MANAGER::AddressAlarms(){
+    //constructed on first use, alarms may be created during static 
+    //initialization of the tool
+    static ADDRESS_ALARM_INDEX address_alarms;
+    return address_alarms;
+}
+
+VOID ALARM_MANAGER::ActivateAddressAlarms(){
+    static BOOL activated = FALSE;
+    if (!activated){
+        activated = TRUE;
+        TRACE_AddInstrumentFunction(InstrumentAddressAlarms, 0);
+    }
+}
+
+VOID ALARM_MANAGER::AddAddressAlarm(ADDRINT address, IALARM* alarm){
+    AddressAlarms()[address].push_back(alarm);
+}
+
+VOID ALARM_MANAGER::RemoveAddressAlarm(ADDRINT address, IALARM* alarm){
+    ADDRESS_ALARM_INDEX& index = AddressAlarms();
+    ADDRESS_ALARM_INDEX::iterator iter = index.find(address);
+    if (iter == index.end()){
+        return;
+    }
+    vector<IALARM*>& alarms = iter->second;
+    for (vector<IALARM*>::iterator it = alarms.begin(); it != alarms.end(); it++){
+        if (*it == alarm){
+            alarms.erase(it);
+            break;
+        }
+    }
+    if (alarms.empty()){
+        index.erase(iter);
+    }
+}
+
+VOID ALARM_MANAGER::InstrumentAddressAlarms(TRACE trace, VOID* v){
+    const ADDRESS_ALARM_INDEX& index = AddressAlarms();
+    if (index.empty()){
+        return;
+    }
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            ADDRESS_ALARM_INDEX::const_iterator iter = 
+                index.find(INS_Address(ins));
+            if (iter == index.end()){
+                continue;
+            }
+            //insert in the order the alarms were added
+            const vector<IALARM*>& alarms = iter->second;
+            for (UINT32 i = 0; i < alarms.size(); i++){
+                alarms[i]->InsertCountAndFire(ins);
+            }
+        }
+    }
+}
+
+ALARM_MANAGER::CODE_PATTERN_INDEX& ALARM_MANAGER::CodePatternAlarms(){
+    static CODE_PATTERN_INDEX code_pattern_alarms;
+    return code_pattern_alarms;
+}
+
+VOID ALARM_MANAGER::AddCodePatternAlarm(const UINT8* pattern, UINT32 len,
+                                        BOOL whole_ins, IALARM* alarm){
+    ASSERT(len > 0, "empty code pattern");
+    CODE_PATTERN_INDEX& index = CodePatternAlarms();
+    if (index.alarms.empty()){
+        index.max_len = 0;
+        TRACE_AddInstrumentFunction(InstrumentCodePatternAlarms, 0);
+    }
+
+    CODE_PATTERN_ALARM code_alarm;
+    code_alarm.pattern.assign(pattern, pattern + len);
+    code_alarm.whole_ins = whole_ins;
+    code_alarm.alarm = alarm;
+    index.by_first_byte[pattern[0]].push_back(index.alarms.size());
+    index.alarms.push_back(code_alarm);
+    if (len > index.max_len){
+        index.max_len = len;
+    }
+}
+
+VOID ALARM_MANAGER::InstrumentCodePatternAlarms(TRACE trace, VOID* v){
+    const CODE_PATTERN_INDEX& index = CodePatternAlarms();
+    
+    //fetch the code of the whole trace once. a pattern starting at the last
+    //instruction may extend past the end of the trace.
+    ADDRINT trace_addr = TRACE_Address(trace);
+    vector<UINT8> code(TRACE_Size(trace) + index.max_len - 1);
+    EXCEPTION_INFO excep = EXCEPTION_INFO();
+    size_t code_size = PIN_FetchCode(&code[0], 
+                                     reinterpret_cast<VOID*>(trace_addr),
+                                     code.size(), &excep);
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        {
+            size_t offset = INS_Address(ins) - trace_addr;
+            if (offset >= code_size){
+                return;
+            }
+            
+            const vector<UINT32>& candidates = 
+                index.by_first_byte[code[offset]];
+            for (UINT32 i = 0; i < candidates.size(); i++){
+                const CODE_PATTERN_ALARM& code_alarm = 
+                    index.alarms[candidates[i]];
+                size_t len = code_alarm.pattern.size();
+                if (code_alarm.whole_ins && INS_Size(ins) != len){
+                    continue;
+                }
+                if (offset + len <= code_size &&
+                    memcmp(&code_alarm.pattern[0], &code[offset], len) == 0){
+                    code_alarm.alarm->InsertCountAndFire(ins);
+                }
+            }
+        }
+    }
+}
+
 VOID ALARM_MANAGER::Activate(){
     if (_tid == ALL_THREADS){
         ArmAll();
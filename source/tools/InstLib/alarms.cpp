@@ -60,124 +60,32 @@ VOID ALARM_ICOUNT::Trace(TRACE trace, VOID* v)
 //*****************************************************************************
 
 VOID ALARM_SSC::Activate(){
-    TRACE_AddInstrumentFunction(Trace, this);
-}
-
-VOID ALARM_SSC::Trace(TRACE trace, VOID* v)
-{
-    ALARM_SSC* ssc_alarm = static_cast<ALARM_SSC*>(v);
-    UINT32 h = Uint32FromString("0x"+ssc_alarm->_ssc);
-    const UINT32 pattern_len = 8;
-    const unsigned int movebx_size = 5;
-    const unsigned int special_nop_size = 3;
-    unsigned int ins_size = 0 ,next_ins_size = 0;
-    EXCEPTION_INFO excep = EXCEPTION_INFO();
-    INS ins,next_ins=INS_Invalid();
-    //the template of ssc marker
-    unsigned char ssc_marker[] = { 0xbb, 0x00, 0x00, 0x00, 0x00,
-                                   0x64, 0x67, 0x90};
+    UINT32 h = Uint32FromString("0x"+_ssc);
+    //the template of ssc marker: mov ebx, <ssc> followed by a special nop
+    UINT8 ssc_marker[_pattern_len] = { 0xbb, 0x00, 0x00, 0x00, 0x00,
+                                       0x64, 0x67, 0x90};
     for(int j=0;j<4;j++){
         //fill in the ssc value
         ssc_marker[1+j]= (h>>(j*8))&0xff;
     }
 
-    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
-    {
-        ins = BBL_InsHead(bbl);
-        if (INS_Valid(ins))
-        {
-            ins_size = INS_Size(ins);
-            next_ins = INS_Next(ins);
-        }
-        while (INS_Valid(next_ins))
-        {
-            next_ins_size = INS_Size(next_ins);
-            if (ins_size + next_ins_size == pattern_len)
-            {
-                unsigned char* pc;
-                pc = reinterpret_cast<unsigned char*>(INS_Address(ins));
-                            
-                unsigned char dst_buf[pattern_len];
-                size_t copy_size = PIN_FetchCode(dst_buf, pc, pattern_len, &excep);
-                if (copy_size == pattern_len &&  
-                  memcmp(ssc_marker,dst_buf,pattern_len) == 0){
-                    InsertIfCall_Count(ssc_alarm, ins, 1);
-                    InsertThenCall_Fire(ssc_alarm, ins);        
-                }
-
-            }
-            ins = next_ins;
-            ins_size = next_ins_size;
-            next_ins = INS_Next(next_ins);
-        }
-        
-        //For the last instruction in the BBL, we want to check the next
-        //instruction, the head of the next BBL.
-        if (ins_size == movebx_size)
-        {
-            BBL next_bbl = BBL_Next(bbl);
-            if (BBL_Valid(next_bbl))
-            {
-                next_ins = BBL_InsHead(next_bbl);
-            }
-            //If the head of the next BBL can potentailly be joint with the
-            //current ins to an ssc_mark, or if this is the last instruction in
-            //the trace.
-            if (!INS_Valid(next_ins) || INS_Size(next_ins) == special_nop_size)
-            {    
-                unsigned char* pc;
-                pc = reinterpret_cast<unsigned char*>(INS_Address(ins));
-                            
-                unsigned char dst_buf[pattern_len];
-                size_t copy_size = PIN_FetchCode(dst_buf, pc, pattern_len, &excep);
-                if (copy_size == pattern_len &&  
-                  memcmp(ssc_marker,dst_buf,pattern_len) == 0){
-                    InsertIfCall_Count(ssc_alarm, ins, 1);
-                    InsertThenCall_Fire(ssc_alarm, ins);        
-                }
-            }
-        }
-    }
+    //the marker spans two instructions, we instrument the first
+    ALARM_MANAGER::AddCodePatternAlarm(ssc_marker, _pattern_len, FALSE, this);
 }
 
 //*****************************************************************************
 
 VOID ALARM_ITEXT::Activate(){
-    TRACE_AddInstrumentFunction(Trace, this);
-}
-
-VOID ALARM_ITEXT::Trace(TRACE trace, VOID* v)
-{
-    ALARM_ITEXT* itext_alarm = static_cast<ALARM_ITEXT*>(v);
-    UINT32 pattern_len = itext_alarm->_itext.length();
+    UINT32 pattern_len = _itext.length();
     UINT32 pattern_bytes = pattern_len / 2; //nibbels -> bytes
     
-    EXCEPTION_INFO excep = EXCEPTION_INFO();
     const size_t max_inst = 15;
-    unsigned char pattern_duf[max_inst];
-    PARSER::str2hex(itext_alarm->_itext.c_str(),pattern_duf,pattern_len);
+    ASSERT(pattern_bytes > 0 && pattern_bytes <= max_inst, 
+           "itext alarm must be a single instruction: " + _itext);
+    UINT8 pattern_buf[max_inst];
+    PARSER::str2hex(_itext.c_str(),pattern_buf,pattern_len);
 
-    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
-    {
-        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
-        {
-            if (INS_Size(ins) == pattern_bytes)
-            {
-                unsigned char* pc;
-                pc = reinterpret_cast<unsigned char*>(INS_Address(ins));
-
-                unsigned char dst_buf[max_inst];
-                size_t copy_size = PIN_FetchCode(dst_buf, pc, pattern_bytes, &excep);
-
-                if (copy_size == pattern_bytes &&  
-                        memcmp(pattern_duf,dst_buf,pattern_bytes) == 0)
-                {
-                    InsertIfCall_Count(itext_alarm, ins, 1);
-                    InsertThenCall_Fire(itext_alarm, ins);        
-                }
-            }
-        }
-    }
+    ALARM_MANAGER::AddCodePatternAlarm(pattern_buf, pattern_bytes, TRUE, this);
 }
 
 //*****************************************************************************
@@ -255,24 +163,8 @@ VOID ALARM_ISA_EXTENSION::Trace(TRACE trace, VOID* v)
 //*****************************************************************************
 
 VOID ALARM_ADDRESS::Activate(){
-    TRACE_AddInstrumentFunction(Trace, this);
-}
-
-VOID ALARM_ADDRESS::Trace(TRACE trace, VOID* v)
-{
-    ALARM_ADDRESS* address_alarm = static_cast<ALARM_ADDRESS*>(v);
-
-    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
-    {
-        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
-        {
-            if (INS_Address(ins) == address_alarm->_address){
-                InsertIfCall_Count(address_alarm, ins, 1);
-                InsertThenCall_Fire(address_alarm, ins);
-            }
-            
-        }
-    }
+    ALARM_MANAGER::ActivateAddressAlarms();
+    ALARM_MANAGER::AddAddressAlarm(_address, this);
 }
 
 //*****************************************************************************
@@ -281,7 +173,7 @@ VOID ALARM_SYMBOL::Activate(){
     PIN_InitSymbols();
     //this is for finding the address of the required symbol
     IMG_AddInstrumentFunction(Img, this);
-    TRACE_AddInstrumentFunction(Trace, this);
+    ALARM_MANAGER::ActivateAddressAlarms();
 }
 
 VOID ALARM_SYMBOL::Img(IMG img, VOID* v)
@@ -292,27 +184,20 @@ VOID ALARM_SYMBOL::Img(IMG img, VOID* v)
     {
         string symbol = SYM_Name(sym);
         if (symbol == symbol_alarm->_symbol){
+            //the alarm applies to the latest image defining the symbol
+            if (symbol_alarm->_resolved){
+                ALARM_MANAGER::RemoveAddressAlarm(symbol_alarm->_address,
+                                                  symbol_alarm);
+            }
             symbol_alarm->_address = SYM_Value(sym) + IMG_LoadOffset(img); 
+            symbol_alarm->_resolved = TRUE;
+            ALARM_MANAGER::AddAddressAlarm(symbol_alarm->_address, 
+                                           symbol_alarm);
             return;
         }
     
     }
 }
-VOID ALARM_SYMBOL::Trace(TRACE trace, VOID* v)
-{
-    ALARM_SYMBOL* symbol_alarm = static_cast<ALARM_SYMBOL*>(v);
-
-    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
-    {
-        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
-        {
-            if (INS_Address(ins) == symbol_alarm->_address){
-                InsertIfCall_Count(symbol_alarm, ins, 1);
-                InsertThenCall_Fire(symbol_alarm, ins);
-            }
-        }
-    }
-}
 
 //*****************************************************************************
 
@@ -320,7 +205,7 @@ VOID ALARM_IMAGE::Activate(){
     PIN_InitSymbols();
     //this is for finding the address of the required symbol
     IMG_AddInstrumentFunction(Img, this);
-    TRACE_AddInstrumentFunction(Trace, this);
+    ALARM_MANAGER::ActivateAddressAlarms();
 }
 
 VOID ALARM_IMAGE::Img(IMG img, VOID* v)
@@ -349,28 +234,18 @@ VOID ALARM_IMAGE::Img(IMG img, VOID* v)
     }
 
     if (found) {
+        //the alarm applies to the latest image with that name
+        if (image_alarm->_resolved){
+            ALARM_MANAGER::RemoveAddressAlarm(image_alarm->_address,
+                                              image_alarm);
+        }
         image_alarm->_address = IMG_LowAddress(img) + image_alarm->_offset;
+        image_alarm->_resolved = TRUE;
+        ALARM_MANAGER::AddAddressAlarm(image_alarm->_address, image_alarm);
         return;
     }
 }
 
-VOID ALARM_IMAGE::Trace(TRACE trace, VOID* v)
-{
-    ALARM_IMAGE* image_alarm = static_cast<ALARM_IMAGE*>(v);
-
-    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
-    {
-        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
-        {
-            if (INS_Address(ins) == image_alarm->_address){
-                InsertIfCall_Count(image_alarm, ins, 1);
-                InsertThenCall_Fire(image_alarm, ins);
-            }
-            
-        }
-    }
-}
-
 //*****************************************************************************
 
 VOID ALARM_INTERACTIVE::Activate(){
@@ -46,10 +46,16 @@ KNOB<BOOL> _knob_source_location(KNOB_MODE_WRITEONCE,
 
 
 ///////////////////////// Analysis Functions //////////////////////////////////
-static void a_process_call(ADDRINT target,
+static void a_process_call(ADDRINT target, CallSiteId site, BOOL is_call,
                ADDRINT sp, CallStack* call_stack)
 {
-    call_stack->process_call(sp, target);
+    call_stack->process_call(sp, target, site, is_call);
+}
+
+static void a_process_indirect_call(ADDRINT target, BOOL is_call,
+               ADDRINT sp, CallStack* call_stack)
+{
+    call_stack->process_call(sp, target, is_call);
 }
 
 
@@ -97,12 +103,6 @@ i_trace(TRACE trace, void *v)
 
         INS tail = BBL_InsTail(bbl);
 
-        //in the original implementation there were special handling for 
-        //push
-        //ret
-        //on ia-32 windows
-        //if this ever become an issue we should add this handling
-
         // We need a special check for RTM instructions cause they are
         // defined as branch as well
 #if defined(SUPPORT_RTM)
@@ -119,6 +119,8 @@ i_trace(TRACE trace, void *v)
             INS_InsertCall(tail, IPOINT_BEFORE,
                                 (AFUNPTR)a_process_call,
                                 IARG_ADDRINT, target,
+                                IARG_UINT32, mngr->intern(target),
+                                IARG_BOOL, INS_IsCall(tail),
                                 IARG_REG_VALUE, REG_STACK_PTR,
                                 IARG_REG_VALUE, vreg,
                                 IARG_END);
@@ -134,8 +136,9 @@ i_trace(TRACE trace, void *v)
         }
         if( INS_IsIndirectBranchOrCall(tail) && !INS_IsRet(tail) ) {
             INS_InsertCall(tail, IPOINT_TAKEN_BRANCH,
-                                (AFUNPTR)a_process_call,
+                                (AFUNPTR)a_process_indirect_call,
                                 IARG_BRANCH_TARGET_ADDR,
+                                IARG_BOOL, INS_IsCall(tail),
                                 IARG_REG_VALUE, REG_STACK_PTR,
                                 IARG_REG_VALUE, vreg,
                                 IARG_END);
@@ -156,12 +159,23 @@ i_trace(TRACE trace, void *v)
         }
 
         if( INS_IsRet(tail) ) {
-            INS_InsertCall(tail, IPOINT_BEFORE,
-                            (AFUNPTR)a_process_return,
-                            IARG_REG_VALUE, REG_STACK_PTR,
-                            IARG_INST_PTR,
-                            IARG_REG_VALUE, vreg,
-                            IARG_END);
+            BOOL push_ret = FALSE;
+#if defined(TARGET_IA32) && defined(TARGET_WINDOWS)
+            // on ia-32 windows
+            // push
+            // ret
+            // is used as a jump, so it does not pop the call stack
+            INS prev = INS_Prev(tail);
+            push_ret = INS_Valid(prev) && INS_Opcode(prev) == XED_ICLASS_PUSH;
+#endif
+            if (!push_ret) {
+                INS_InsertCall(tail, IPOINT_BEFORE,
+                                (AFUNPTR)a_process_return,
+                                IARG_REG_VALUE, REG_STACK_PTR,
+                                IARG_INST_PTR,
+                                IARG_REG_VALUE, vreg,
+                                IARG_END);
+            }
 
             INS_InsertIfCall(tail, IPOINT_TAKEN_BRANCH,
                 (AFUNPTR)a_on_ret_should_fire,
@@ -192,13 +206,53 @@ static string RemoveNamespace(const string& name){
 
 ///////////////////////////////////////////////////////////////////////////////
 
+CallStack::CallStack(): _push_handler(0), _pop_handler(0), _handlers_arg(0)
+{
+    for (UINT32 i = 0; i < SITE_CACHE_SIZE; i++){
+        _site_cache[i].target = 0;
+        _site_cache[i].site = 0;
+    }
+}
+
 void
 CallStack::create_entry( ADDRINT current_sp,
-                              ADDRINT target)
+                              ADDRINT target,
+                              CallSiteId site,
+                              BOOL is_call)
 {
     // push entry -- note this is sp at the callsite
-    CallEntry entry(current_sp, target);
+    CallEntry entry(current_sp, target, site, is_call);
     _call_vec.push_back(entry);
+    if (is_call && _push_handler){
+        _push_handler(site, _handlers_arg);
+    }
+}
+
+void CallStack::pop_entry()
+{
+    BOOL is_call = _call_vec.back().is_call();
+    _call_vec.pop_back();
+    if (is_call && _pop_handler){
+        _pop_handler(_handlers_arg);
+    }
+}
+
+void CallStack::set_call_handlers(CALL_STACK_PUSH_HANDLER push,
+                                  CALL_STACK_POP_HANDLER pop, VOID* v)
+{
+    _push_handler = push;
+    _pop_handler = pop;
+    _handlers_arg = v;
+}
+
+CallSiteId CallStack::intern(ADDRINT target)
+{
+    SiteCacheEntry& e = _site_cache[(target ^ (target >> 8)) & (SITE_CACHE_SIZE - 1)];
+    if (e.site == 0 || e.target != target){
+        e.target = target;
+        e.site = CallStackManager::get_instance()->intern(target);
+    }
+    return e.site;
 }
 
 
@@ -212,7 +266,7 @@ void CallStack::adjust_stack( ADDRINT current_sp )
     //original comment:
     //TIPP: I changed this from > to >= ...not sure it's right, but works better
     while( current_sp >= _call_vec.back().sp() ) {
-        _call_vec.pop_back();
+        pop_entry();
         if( _call_vec.size() == 0 ){
             break;
         }
@@ -221,11 +275,20 @@ void CallStack::adjust_stack( ADDRINT current_sp )
 
 // standard call
 void  CallStack::process_call(ADDRINT current_sp,
-                              ADDRINT target)
+                              ADDRINT target,
+                              CallSiteId site,
+                              BOOL is_call)
 {
     // check if we got here from a longjmp.
     adjust_stack(current_sp);
-    create_entry(current_sp, target);
+    create_entry(current_sp, target, site, is_call);
+}
+
+void  CallStack::process_call(ADDRINT current_sp,
+                              ADDRINT target,
+                              BOOL is_call)
+{
+    process_call(current_sp, target, intern(target), is_call);
 }
 
 // standard return
@@ -250,24 +313,29 @@ CallStack::process_return( ADDRINT current_sp, ADDRINT ip )
         //  ret ...
         //so if the stack size is 0 we are ignoring this.
         
-        _call_vec.pop_back();
+        pop_entry();
     }
 }
 
 void CallStack::push_head(ADDRINT current_sp, ADDRINT target){
-   create_entry(current_sp,target);
+   create_entry(current_sp,target,intern(target),FALSE);
 }
 
 void CallStack::save_all_ips_info(){
     
-    CallStackInfo info;
     CallStackManager* mngr = CallStackManager::get_instance();
     for (UINT32 i = 0; i< depth(); i++){
-        ADDRINT ip = _call_vec[i].target();
-        mngr->get_ip_info(ip, info);
+        mngr->site_info(_call_vec[i].site());
     }   
 }
 
+void CallStack::snapshot(vector<CallSiteId>& sites) const{
+    sites.resize(_call_vec.size());
+    for (UINT32 i = 0; i < _call_vec.size(); i++){
+        sites[i] = _call_vec[i].site();
+    }
+}
+
 ADDRINT CallStack::top_target(){
     return _call_vec.back().target();
 }
@@ -285,7 +353,7 @@ void CallStack::emit_stack( UINT32 depth,
     INT32 level;
     INT32 id;
     ostringstream o;
-    CallStackInfo info;
+    CallStackManager* mngr = CallStackManager::get_instance();
     
     UINT32 width = sizeof(ADDRINT) * 2; //bytes => nibbles
     BOOL _source_location = _knob_source_location;
@@ -307,8 +375,7 @@ void CallStack::emit_stack( UINT32 depth,
     o.str("");
     //emit the call stack
     for(iter = _call_vec.rbegin(); iter != _call_vec.rend(); iter++) {
-        CallStackManager* mngr = CallStackManager::get_instance();
-        mngr->get_ip_info(iter->target(), info);
+        const CallStackInfo& info = mngr->site_info(iter->site());
 
         o << right << dec << setw(2) << id << "# ";
         o << "0x" << hex << setw(width) << setfill('0') << iter->target() << "  ";
@@ -338,19 +405,35 @@ void CallStack::emit_stack( UINT32 depth,
 
 CallStackManager* CallStackManager::_instance = 0;
 
+CallStackManager::CallStackManager(): _activated(false),_use_ctxt(false),
+    _depth_func_handlers_tid_vec(PIN_MAX_THREADS){
+    PIN_InitLock(&_lock);
+    for (UINT32 i = 0; i < MAX_SITE_CHUNKS; i++){
+        _site_chunks[i] = 0;
+    }
+    //site 0 means "no site"
+    _site_chunks[0] = new CallSite[SITE_CHUNK_SIZE];
+    _site_chunks[0][0].ip = 0;
+    _site_chunks[0][0].resolved = FALSE;
+    _num_sites = 1;
+}
+
 void CallStackManager::thread_begin(THREADID tid, CONTEXT* ctxt,
                                     INT32 flags, void* v){
     CallStack* call_stack = new CallStack();
     CallStackManager* call_stack_manager = reinterpret_cast<CallStackManager*>(v);
-    call_stack_manager->add_stack(tid, call_stack);
+    PIN_SetThreadData(call_stack_manager->_tls_key, call_stack, tid);
         
     PIN_SetContextReg(ctxt, vreg, (ADDRINT)call_stack);
 
 
 }
 
-void CallStackManager::add_stack(THREADID tid, CallStack* call_stack){
-    _call_stack_map[tid] = call_stack;
+void CallStackManager::thread_end(THREADID tid, const CONTEXT* ctxt,
+                                  INT32 code, void* v){
+    CallStackManager* call_stack_manager = reinterpret_cast<CallStackManager*>(v);
+    delete call_stack_manager->stack(tid);
+    PIN_SetThreadData(call_stack_manager->_tls_key, 0, tid);
 }
 
 void CallStackManager::activate(){
@@ -360,7 +443,9 @@ void CallStackManager::activate(){
     _activated = true;
 
     vreg = PIN_ClaimToolRegister();
+    _tls_key = PIN_CreateThreadDataKey(0);
     PIN_AddThreadStartFunction(thread_begin, this);
+    PIN_AddThreadFiniFunction(thread_end, this);
     TRACE_AddInstrumentFunction(i_trace, this);
     IMG_AddInstrumentFunction(Img, this);
 }
@@ -375,29 +460,64 @@ CallStackManager* CallStackManager::get_instance(){
 }
 
 CallStack CallStackManager::get_stack(THREADID tid){
-    CallStack* call_stack = _call_stack_map[tid];
+    CallStack* call_stack = stack(tid);
     return *call_stack; //copy const. 
 }
 
+CallStack* CallStackManager::stack(THREADID tid){
+    return static_cast<CallStack*>(PIN_GetThreadData(_tls_key, tid));
+}
+
 void CallStackManager::get_ip_info(
     ADDRINT ip,
     CallStackInfo& info)
 {
-    
-    PIN_GetLock(&_lock,0);
-    CallStackInfoMap::iterator it = _call_stack_info.find(ip);
+    info = site_info(intern(ip));
+}
 
-    if ( it != _call_stack_info.end() ) {
+CallSiteId CallStackManager::intern(ADDRINT ip){
+    PIN_GetLock(&_lock,0);
+    CallSiteIdMap::iterator it = _site_ids.find(ip);
+    if (it != _site_ids.end()){
+        CallSiteId id = it->second;
         PIN_ReleaseLock(&_lock);
-        info.image_name = it->second.image_name.c_str();
-        info.file_name  = it->second.file_name.c_str();
-        info.func_name  = it->second.func_name.c_str();
-        info.line = it->second.line;
-        info.column = it->second.column;
-        return;
+        return id;
+    }
+
+    CallSiteId id = _num_sites;
+    UINT32 chunk = id >> SITE_CHUNK_BITS;
+    ASSERT(chunk < MAX_SITE_CHUNKS, "too many call sites\n");
+    if (_site_chunks[chunk] == 0){
+        _site_chunks[chunk] = new CallSite[SITE_CHUNK_SIZE];
+    }
+    site(id).ip = ip;
+    site(id).resolved = FALSE;
+    _site_ids[ip] = id;
+    _num_sites++;
+    PIN_ReleaseLock(&_lock);
+    return id;
+}
+
+ADDRINT CallStackManager::site_address(CallSiteId id){
+    return site(id).ip;
+}
+
+const CallStackInfo& CallStackManager::site_info(CallSiteId id){
+    CallSite& s = site(id);
+
+    PIN_GetLock(&_lock,0);
+    BOOL resolved = s.resolved;
+    PIN_ReleaseLock(&_lock);
+    if (resolved){
+        return s.info;
     }
 
+    // resolve without holding _lock, the instrumentation interns sites
+    // while it holds the client lock
+    const ADDRINT ip = s.ip;
     CallStackInfo i;
+    i.line = 0;
+    i.column = 0;
 
     PIN_LockClient();
     i.func_name = RTN_FindNameByAddress(ip);
@@ -406,8 +526,6 @@ void CallStackManager::get_ip_info(
     if (_knob_source_location){
         PIN_GetSourceLocation(ip, &i.column, &i.line, &i.file_name);
     }
-    
-    PIN_UnlockClient();
         
     if (IMG_Valid(img)) {
         i.image_name = IMG_Name(img);
@@ -419,11 +537,15 @@ void CallStackManager::get_ip_info(
     else{
         i.image_name =  "UNKNOWN IMAGE";
     }
-            
-    info = i;
+    PIN_UnlockClient();
 
-    _call_stack_info[ip] = i;
+    PIN_GetLock(&_lock,0);
+    if (!s.resolved){
+        s.info = i;
+        s.resolved = TRUE;
+    }
     PIN_ReleaseLock(&_lock);
+    return s.info;
 }
 
 BOOL CallStackManager::NeedContext(){
@@ -519,7 +641,7 @@ void CallStackManager::on_call(THREADID tid, CONTEXT* ctxt, ADDRINT ip){
     //recored the stack depth if this is a requested exit functioniter = _exit_func_handlers_map.find(ip);
     iter = _exit_func_handlers_map.find(ip);
     if (iter != _exit_func_handlers_map.end()){
-        UINT32 depth = get_stack(tid).depth();
+        UINT32 depth = stack(tid)->depth();
         DepthFuncHandlersMap& m = _depth_func_handlers_tid_vec[tid];
         m[depth] = iter->second; //a vector of handlers
         _marked_ip_for_exit.insert(ip);
@@ -532,7 +654,7 @@ void CallStackManager::on_call(THREADID tid, CONTEXT* ctxt, ADDRINT ip){
 // the call-stack beyond the recorded depth.
 // if so,  we return 1 so the  Then instrumentation will be called
 BOOL CallStackManager::on_ret_should_fire(THREADID tid){
-    UINT32 depth = get_stack(tid).depth();
+    UINT32 depth = stack(tid)->depth();
     DepthFuncHandlersMap::iterator iter;
     DepthFuncHandlersMap& m = _depth_func_handlers_tid_vec[tid];
     
@@ -554,7 +676,7 @@ BOOL CallStackManager::on_ret_should_fire(THREADID tid){
 //    1. we call all the registered handlers
 //    2. remove the 'depth' entry so it will not be call again later.
 void CallStackManager::on_ret_fire(THREADID tid, CONTEXT* ctxt, ADDRINT ip){
-    UINT32 depth = get_stack(tid).depth();
+    UINT32 depth = stack(tid)->depth();
     DepthFuncHandlersMap::iterator iter;
     DepthFuncHandlersMap::iterator earase_iter;
     DepthFuncHandlersMap& m = _depth_func_handlers_tid_vec[tid];
@@ -121,6 +121,45 @@ END_LEGAL */
  *          TraceLog.push_back(....);
  *          PIN_ReleaseLock(....);
  *      }
+ *
+ * The "break if load from <addr>" and "break if store to <addr>" events (and the
+ * equivalent tracepoints) are an exception to the one-check-per-event pattern.
+ * A program can have many of these watchpoints, and each would otherwise add
+ * another check to every memory instruction.  Instead, all active watchpoints
+ * are collected into a single sorted array plus a small filter table indexed by
+ * a hash of the address, and each memory instruction gets at most one check
+ * for breakpoints and one for tracepoints:
+ *
+ *      if (WatchFilter[Hash(<load EA>)] & LOAD_KINDS |
+ *          WatchFilter[Hash(<store EA>)] & STORE_KINDS)
+ *      {
+ *          Search the sorted array for events at <load EA> or <store EA>
+ *          and trigger the breakpoint / record the tracepoints.
+ *      }
+ *      [Original Instruction]
+ *
+ * The array and the filter are rebuilt whenever the set of events changes,
+ * right before the code cache is flushed.
+ *
+ * When instruction counting is enabled, the shell can also take checkpoints of
+ * a single-threaded application every N instructions ("checkpoint every <count>").
+ * A checkpoint is taken by calling the application's fork() from an analysis
+ * routine.  The child is the checkpoint: it blocks reading a pipe until the
+ * debugger asks to restart from it ("restart at icount <count>"), or until the
+ * pipe is closed because every process that could restart it has exited.  The
+ * parent keeps running.  A restarted checkpoint runs forward to the requested
+ * instruction count and then stops and waits for a debugger to connect, so
+ * reaching a point late in a long run takes at most N instructions instead of
+ * a rerun from the start.  Only the newest checkpoints are kept ("checkpoint
+ * limit <count>", 16 by default); older ones are discarded by closing their
+ * pipe.  The check is one more "if" call per instruction,
+ * using the same per-thread counters as "break if icount":
+ *
+ *      if (THREAD_DATA->_icount == CheckpointStop)
+ *      {
+ *          Take a checkpoint and / or stop at the restart target.
+ *      }
+ *      THREAD_DATA->_icount++
  */
 
 #include <iostream>
@@ -132,6 +171,8 @@ END_LEGAL */
 #include <map>
 #include <algorithm>
 #include <cctype>
+#include <cstring>
+#include <climits>
 #include "debugger-shell.H"
 
 
@@ -335,6 +376,37 @@ private:
     typedef std::map<unsigned, EVENT> EVENTS;
     EVENTS _events;
 
+    // Kinds of TRIGGER_LOAD_FROM and TRIGGER_STORE_TO events, used as bits in '_watchFilter'.
+    //
+    enum WATCH_KIND
+    {
+        WATCH_LOAD_BREAK = 0x1,     // Breakpoint before load from address.
+        WATCH_STORE_BREAK = 0x2,    // Breakpoint before store to address.
+        WATCH_LOAD_TRACE = 0x4,     // Tracepoint before load from address.
+        WATCH_STORE_TRACE = 0x8     // Tracepoint before store to address.
+    };
+
+    // One active TRIGGER_LOAD_FROM or TRIGGER_STORE_TO event.
+    //
+    struct WATCH
+    {
+        ADDRINT _ea;            // Address that triggers the event.
+        UINT32 _kind;           // One of the WATCH_KIND bits.
+        unsigned _id;           // Event ID.
+        const EVENT *_event;    // Points into '_events'.
+    };
+
+    // All active watches, sorted by address and then by event ID.  '_watchFilter' has
+    // the OR of the WATCH_KIND bits of all watches whose address hashes to each slot,
+    // so memory instructions only search '_watches' when the filter hits.  Both are
+    // rebuilt by Flush().
+    //
+    static const unsigned WatchFilterSize = 4096;
+    typedef std::vector<WATCH> WATCHES;
+    WATCHES _watches;
+    UINT8 _watchFilter[WatchFilterSize];
+    UINT32 _watchKinds;     // OR of the kinds of all watches.
+
     unsigned _nextEventId;
 
     // A trace record collected when executing a tracepoint.
@@ -367,6 +439,38 @@ private:
         UINT64 _mcount;
     };
 
+    // A checkpoint is a forked copy of the process, taken when the checkpoint thread reached
+    // '_icount' instructions.  The copy waits until a restart target is written to its pipe.
+    //
+    struct CHECKPOINT
+    {
+        unsigned _id;       // Checkpoint number, as shown by "list checkpoints".
+        UINT64 _icount;     // Instruction count of the checkpoint thread.
+        INT32 _pid;         // Process ID of the copy.
+        NATIVE_FD _fd;      // Write end of the copy's pipe.
+    };
+
+    typedef std::vector<CHECKPOINT> CHECKPOINTS;
+    CHECKPOINTS _checkpoints;
+    unsigned _nextCheckpointId;
+    unsigned _maxCheckpoints;       // Live checkpoints kept; older ones are discarded.
+    unsigned _checkpointsDiscarded; // Checkpoints discarded because of '_maxCheckpoints'.
+
+    AFUNPTR _forkFunction;          // The application's fork(), or NULL if not found.
+    unsigned _numThreads;           // Number of live application threads.
+    UINT64 _checkpointInterval;     // Instructions between checkpoints, zero if disabled.
+    UINT64 _nextCheckpoint;         // Instruction count of the next checkpoint.
+    unsigned _checkpointsSkipped;   // Checkpoints skipped because of other threads.
+    BOOL _isRestarted;              // TRUE if this process is a restarted checkpoint.
+    BOOL _hasRestartStop;           // TRUE if this process was restarted and has not stopped yet.
+    UINT64 _restartStop;            // Instruction count where a restarted process stops.
+    UINT64 _restartedFrom;          // Instruction count of the checkpoint this process was restarted from.
+
+    // Thread and instruction count of the next checkpoint or restart stop, whichever comes
+    // first.  Instrumented code compares against this, so it is updated in place.
+    //
+    AT_ICOUNT _checkpointStop;
+
     // Help messages are formatted to be no wider than this number of characters.
     //
     static const unsigned MaxHelpWidth = 80;
@@ -393,6 +497,21 @@ public:
             return FALSE;
         }
         PIN_InitLock(&_traceLock);
+        RebuildWatches();
+        _nextCheckpointId = 1;
+        _maxCheckpoints = 16;
+        _checkpointsDiscarded = 0;
+        _forkFunction = 0;
+        _numThreads = 0;
+        _checkpointInterval = 0;
+        _nextCheckpoint = 0;
+        _checkpointsSkipped = 0;
+        _isRestarted = FALSE;
+        _hasRestartStop = FALSE;
+        _restartStop = 0;
+        _restartedFrom = 0;
+        _checkpointStop._icount = 0;
+        _checkpointStop._tid = INVALID_THREADID;
         _nextHelpCategory = DEBUGGER_SHELL::HELP_CATEGORY_END;
         _nextEventId = 1;
         _isEnabled = FALSE;
@@ -425,6 +544,13 @@ public:
         // Trace instrumentation, to handle debugger commands.
         //
         TRACE_AddInstrumentFunction(InstrumentTrace, this);
+
+#if defined(TARGET_LINUX)
+        // Checkpoints fork the application, so they need its fork() function.
+        //
+        if (_clientArgs._enableIcountBreakpoints)
+            IMG_AddInstrumentFunction(FindForkFunction, this);
+#endif
         _isEnabled = TRUE;
         return TRUE;
     }
@@ -484,6 +610,7 @@ private:
 
         td->_tid = tid;
         PIN_SetContextReg(ctxt, ds->_regThreadData, ADDRINT(td));
+        ds->_numThreads++;
     }
 
     /*
@@ -502,6 +629,25 @@ private:
 
         td = reinterpret_cast<THREAD_DATA *>(PIN_GetContextReg(ctxt, ds->_regThreadData));
         if (td) delete td;
+        ds->_numThreads--;
+    }
+
+    /*
+     * Pin call-back that is invoked when an image is loaded.  Remembers the
+     * application's fork() function, which is used to take checkpoints.
+     *
+     *  @param[in] img  The image.
+     *  @param[in] v    Pointer to ISHELL instance.
+     */
+    static VOID FindForkFunction(IMG img, VOID *v)
+    {
+        SHELL *me = static_cast<SHELL *>(v);
+
+        if (me->_forkFunction)
+            return;
+        RTN rtn = RTN_FindByName(img, "fork");
+        if (RTN_Valid(rtn))
+            me->_forkFunction = reinterpret_cast<AFUNPTR>(RTN_Address(rtn));
     }
     
     /*
@@ -538,6 +684,13 @@ private:
          *  list breakpoints
          *  delete breakpoint <id>
          *
+         * Checkpoint Commands:
+         *
+         *  checkpoint every <count>
+         *  checkpoint limit <count>
+         *  list checkpoints
+         *  restart at icount <count>
+         *
          * Tracing Commands:
          *
          *  trace [<reg>] at <pc>
@@ -783,6 +936,38 @@ private:
             *result = me->ParseTriggerAtCount(ETYPE_BREAKPOINT, words[3], TRIGGER_AT_MCOUNT, tid);
             return TRUE;
         }                
+        else if (me->_clientArgs._enableIcountBreakpoints && nWords == 3 && words[0] == "checkpoint" &&
+            words[1] == "every")
+        {
+            // checkpoint every <count>
+            //
+            *result = me->SetCheckpointInterval(words[2], tid, ctxt);
+            return TRUE;
+        }
+        else if (me->_clientArgs._enableIcountBreakpoints && nWords == 3 && words[0] == "checkpoint" &&
+            words[1] == "limit")
+        {
+            // checkpoint limit <count>
+            //
+            *result = me->SetCheckpointLimit(words[2]);
+            return TRUE;
+        }
+        else if (me->_clientArgs._enableIcountBreakpoints && nWords == 2 && words[0] == "list" &&
+            words[1] == "checkpoints")
+        {
+            // list checkpoints
+            //
+            *result = me->ListCheckpoints();
+            return TRUE;
+        }
+        else if (me->_clientArgs._enableIcountBreakpoints && nWords == 4 && words[0] == "restart" &&
+            words[1] == "at" && words[2] == "icount")
+        {
+            // restart at icount <count>
+            //
+            *result = me->RestartAtIcount(words[3]);
+            return TRUE;
+        }
         else if (nWords == 5 && words[0] == "break" && words[1] == "if" && words[2] == "jump" &&
             words[3] == "to")
         {
@@ -808,10 +993,94 @@ private:
      */
     VOID Flush()
     {
+        RebuildWatches();
         CODECACHE_FlushCache();
     }
 
 
+    /*
+     * Rebuild '_watches' and '_watchFilter' from the active TRIGGER_LOAD_FROM and
+     * TRIGGER_STORE_TO events.
+     */
+    VOID RebuildWatches()
+    {
+        _watches.clear();
+        memset(_watchFilter, 0, sizeof(_watchFilter));
+        _watchKinds = 0;
+
+        for (EVENTS::iterator it = _events.begin();  it != _events.end();  ++it)
+        {
+            const EVENT &evnt = it->second;
+            if (evnt._type == ETYPE_TRACEPOINT && (evnt._isDeleted || !evnt._isEnabled))
+                continue;
+
+            // A client's custom breakpoint instrumentation is passed the message of a single
+            // event, so these breakpoints are still instrumented one by one.
+            //
+            if (evnt._type == ETYPE_BREAKPOINT && _clientArgs._customInstrumentor)
+                continue;
+
+            BOOL isBreak = (evnt._type == ETYPE_BREAKPOINT);
+            WATCH watch;
+            if (evnt._trigger == TRIGGER_LOAD_FROM)
+                watch._kind = isBreak ? WATCH_LOAD_BREAK : WATCH_LOAD_TRACE;
+            else if (evnt._trigger == TRIGGER_STORE_TO)
+                watch._kind = isBreak ? WATCH_STORE_BREAK : WATCH_STORE_TRACE;
+            else
+                continue;
+            watch._ea = evnt._ea;
+            watch._id = it->first;
+            watch._event = &evnt;
+
+            _watches.push_back(watch);
+            _watchFilter[WatchSlot(watch._ea)] |= watch._kind;
+            _watchKinds |= watch._kind;
+        }
+        std::sort(_watches.begin(), _watches.end(), CompareWatches);
+    }
+
+
+    /*
+     * Find the watches on an address.
+     *
+     *  @param[in] ea       The address.
+     *  @param[in] kinds    Only find watches with one of these WATCH_KIND bits.
+     *  @param[out] found   Receives the matching watches, in order of event ID.
+     */
+    VOID FindWatches(ADDRINT ea, UINT32 kinds, std::vector<const WATCH *> *found)
+    {
+        if (!kinds)
+            return;
+
+        WATCH key;
+        key._ea = ea;
+        key._id = 0;
+        for (WATCHES::const_iterator it = std::lower_bound(_watches.begin(), _watches.end(), key, CompareWatches);
+             it != _watches.end() && it->_ea == ea;  ++it)
+        {
+            if (it->_kind & kinds)
+                found->push_back(&*it);
+        }
+    }
+
+    static ADDRINT WatchSlot(ADDRINT ea)
+    {
+        return (ea ^ (ea >> 12)) & (WatchFilterSize - 1);
+    }
+
+    static bool CompareWatches(const WATCH &a, const WATCH &b)
+    {
+        if (a._ea != b._ea)
+            return a._ea < b._ea;
+        return a._id < b._id;
+    }
+
+    static bool CompareWatchIds(const WATCH *a, const WATCH *b)
+    {
+        return a->_id < b->_id;
+    }
+
+
     /*
      * Split an input command into a series of whitespace-separated words.  Leading
      * and trailing whitespace is ignored.
@@ -965,6 +1234,17 @@ private:
                 "Break current thread before it reaches <count> instructions from the start of execution."));
             helpCommands->push_back(HELP("break if mcount <count>",
                 "Break current thread before it reaches <count> memory instructions from the start of execution."));
+            helpCommands->push_back(HELP("checkpoint every <count>",
+                "Checkpoint the process now and then every <count> instructions of the current thread.  "
+                "Checkpoints are skipped while other threads exist.  Zero stops taking checkpoints."));
+            helpCommands->push_back(HELP("checkpoint limit <count>",
+                "Keep at most <count> checkpoints, discarding the oldest ones.  The default is 16."));
+            helpCommands->push_back(HELP("list checkpoints",
+                "List all checkpoints."));
+            helpCommands->push_back(HELP("restart at icount <count>",
+                "Restart from the latest checkpoint at or before <count> instructions.  The restarted "
+                "process stops before <count> instructions and waits for a debugger to connect.  "
+                "Kill this process after reconnecting."));
         }
 
         helpCommands->push_back(HELP("break if jump to <pc>",
@@ -1287,6 +1567,275 @@ private:
         return ret;
     }
 
+    /*
+     * Start or stop taking checkpoints.
+     *
+     *  @param[in] countStr     Number of instructions between checkpoints, or zero.
+     *  @param[in] tid          The thread whose instructions are counted.
+     *  @param[in] ctxt         Register state of \a tid.
+     *
+     * @return  A string to return to the debugger prompt.
+     */
+    std::string SetCheckpointInterval(const std::string &countStr, THREADID tid, const CONTEXT *ctxt)
+    {
+        UINT64 count = 0;
+        if (!ParseNumber(countStr, &count))
+        {
+            std::ostringstream os;
+            os << "Invalid value " << countStr << "\n";
+            return os.str();
+        }
+        if (count && !_forkFunction)
+            return "Checkpoints are not supported: the application's fork() was not found\n";
+
+        _checkpointInterval = count;
+        if (count)
+        {
+            // Take the first checkpoint as soon as the thread resumes.
+            //
+            THREAD_DATA *td = reinterpret_cast<THREAD_DATA *>(PIN_GetContextReg(ctxt, _regThreadData));
+            _checkpointStop._tid = tid;
+            _nextCheckpoint = td->_icount;
+        }
+        UpdateCheckpointStop();
+        Flush();
+
+        std::ostringstream os;
+        if (count)
+            os << "Checkpoint thread " << std::dec << tid << " every " << count << " instructions\n";
+        else
+            os << "Stopped taking checkpoints\n";
+        return os.str();
+    }
+
+
+    /*
+     * Set the number of checkpoints to keep.
+     *
+     *  @param[in] countStr     Maximum number of live checkpoints.
+     *
+     * @return  A string to return to the debugger prompt.
+     */
+    std::string SetCheckpointLimit(const std::string &countStr)
+    {
+        unsigned count = 0;
+        if (!ParseNumber(countStr, &count) || count == 0)
+        {
+            std::ostringstream os;
+            os << "Invalid value " << countStr << "\n";
+            return os.str();
+        }
+
+        _maxCheckpoints = count;
+        DiscardOldCheckpoints();
+
+        std::ostringstream os;
+        os << "Keep at most " << std::dec << count << " checkpoints\n";
+        return os.str();
+    }
+
+
+    /*
+     * Discard the oldest checkpoints until at most '_maxCheckpoints' are left.  A
+     * discarded checkpoint sees end-of-file on its pipe and exits.
+     */
+    VOID DiscardOldCheckpoints()
+    {
+        while (_checkpoints.size() > _maxCheckpoints)
+        {
+            OS_CloseFD(_checkpoints.front()._fd);
+            _checkpoints.erase(_checkpoints.begin());
+            _checkpointsDiscarded++;
+        }
+    }
+
+
+    /*
+     * @return  A single string showing all the checkpoints.
+     */
+    std::string ListCheckpoints()
+    {
+        std::ostringstream os;
+
+        for (CHECKPOINTS::iterator it = _checkpoints.begin();  it != _checkpoints.end();  ++it)
+        {
+            os << "#" << std::dec << it->_id << ":  thread " << _checkpointStop._tid <<
+                " icount " << it->_icount << " (pid " << it->_pid << ")\n";
+        }
+        if (_isRestarted)
+            os << "This process was restarted from icount " << std::dec << _restartedFrom << "\n";
+        if (_checkpointsSkipped)
+            os << std::dec << _checkpointsSkipped << " checkpoints skipped because of other threads\n";
+        if (_checkpointsDiscarded)
+            os << std::dec << _checkpointsDiscarded << " checkpoints discarded to keep at most " <<
+                _maxCheckpoints << "\n";
+        return os.str();
+    }
+
+
+    /*
+     * Restart from the latest checkpoint at or before an instruction count.
+     *
+     *  @param[in] countStr     The instruction count where the restarted process stops.
+     *
+     * @return  A string to return to the debugger prompt.
+     */
+    std::string RestartAtIcount(const std::string &countStr)
+    {
+        UINT64 count = 0;
+        if (!ParseNumber(countStr, &count))
+        {
+            std::ostringstream os;
+            os << "Invalid value " << countStr << "\n";
+            return os.str();
+        }
+
+        // Checkpoints are in order of increasing instruction count.
+        //
+        CHECKPOINTS::iterator best = _checkpoints.end();
+        for (CHECKPOINTS::iterator it = _checkpoints.begin();  it != _checkpoints.end();  ++it)
+        {
+            if (it->_icount <= count)
+                best = it;
+        }
+        if (best == _checkpoints.end())
+        {
+            std::ostringstream os;
+            os << "No checkpoint at or before icount " << std::dec << count << "\n";
+            return os.str();
+        }
+
+        USIZE size = sizeof(count);
+        OS_RETURN_CODE ret = OS_WriteFD(best->_fd, &count, &size);
+        OS_CloseFD(best->_fd);
+        CHECKPOINT restarted = *best;
+        _checkpoints.erase(best);
+        if (!OS_RETURN_CODE_IS_SUCCESS(ret) || size != sizeof(count))
+        {
+            std::ostringstream os;
+            os << "Checkpoint #" << std::dec << restarted._id << " (pid " << restarted._pid <<
+                ") is gone\n";
+            return os.str();
+        }
+
+        std::ostringstream os;
+        os << "Restarted checkpoint #" << std::dec << restarted._id << " (icount " << restarted._icount <<
+            ") as process " << restarted._pid << ".  It stops at icount " << count <<
+            " and waits for a debugger to connect.\n";
+        return os.str();
+    }
+
+
+    /*
+     * Recompute '_checkpointStop' after the next checkpoint or restart target changes.
+     */
+    VOID UpdateCheckpointStop()
+    {
+        UINT64 stop = ULLONG_MAX;
+        if (_checkpointInterval)
+            stop = _nextCheckpoint;
+        if (_hasRestartStop && _restartStop < stop)
+            stop = _restartStop;
+        _checkpointStop._icount = stop;
+    }
+
+
+    /*
+     * @return  TRUE if instructions need to check for a checkpoint or restart stop.
+     */
+    BOOL CheckpointsActive()
+    {
+        return _checkpointInterval || _hasRestartStop;
+    }
+
+
+    /*
+     * Take a checkpoint by forking the application.  In the parent, this records the
+     * new checkpoint and returns.  In the child, this waits until the checkpoint is
+     * restarted and then returns, or exits if the checkpoint is discarded.
+     *
+     *  @param[in] ctxt     Register state before the current instruction.
+     *  @param[in] tid      The calling thread.
+     *  @param[in] icount   The thread's instruction count.
+     */
+    VOID TakeCheckpoint(CONTEXT *ctxt, THREADID tid, UINT64 icount)
+    {
+        // fork() only copies the calling thread, so the copy of a multi-threaded
+        // application could not be resumed correctly.
+        //
+        if (_numThreads != 1)
+        {
+            _checkpointsSkipped++;
+            return;
+        }
+
+        NATIVE_FD readFd, writeFd;
+        if (!OS_RETURN_CODE_IS_SUCCESS(OS_Pipe(OS_PIPE_CREATE_FLAGS_NONE, &readFd, &writeFd)))
+        {
+            _checkpointsSkipped++;
+            return;
+        }
+
+        // Call the application's fork() so that Pin sees the new process and keeps
+        // instrumenting it.
+        //
+        INT32 pid = -1;
+        PIN_CallApplicationFunction(ctxt, tid, CALLINGSTD_DEFAULT, _forkFunction, NULL,
+            PIN_PARG(INT32), &pid, PIN_PARG_END());
+
+        if (pid < 0)
+        {
+            OS_CloseFD(readFd);
+            OS_CloseFD(writeFd);
+            _checkpointsSkipped++;
+            return;
+        }
+
+        if (pid > 0)
+        {
+            OS_CloseFD(readFd);
+            CHECKPOINT checkpoint;
+            checkpoint._id = _nextCheckpointId++;
+            checkpoint._icount = icount;
+            checkpoint._pid = pid;
+            checkpoint._fd = writeFd;
+            _checkpoints.push_back(checkpoint);
+            DiscardOldCheckpoints();
+            return;
+        }
+
+        // This is the checkpoint.  Any process that can restart it holds the write
+        // end of the pipe, so end-of-file means it can never be restarted.  Exit
+        // without running the tool's fini call-backs in that case.  The copy must
+        // not hold the pipes of the older checkpoints either, or they would never
+        // see end-of-file.
+        //
+        OS_CloseFD(writeFd);
+        for (CHECKPOINTS::iterator it = _checkpoints.begin();  it != _checkpoints.end();  ++it)
+            OS_CloseFD(it->_fd);
+        _checkpoints.clear();
+        _checkpointsDiscarded = 0;
+        _checkpointsSkipped = 0;
+
+        // A restarted process does not take checkpoints of its own unless asked to.
+        //
+        _checkpointInterval = 0;
+        _nextCheckpoint = 0;
+
+        UINT64 target = 0;
+        USIZE size = sizeof(target);
+        OS_RETURN_CODE ret = OS_ReadFD(readFd, &size, &target);
+        OS_CloseFD(readFd);
+        if (!OS_RETURN_CODE_IS_SUCCESS(ret) || size != sizeof(target))
+            OS_ExitProcess(0);
+
+        _isRestarted = TRUE;
+        _hasRestartStop = TRUE;
+        _restartStop = target;
+        _restartedFrom = icount;
+    }
+
+
     /*
      * Delete an event.
      *
@@ -2175,7 +2724,13 @@ private:
                     me->InsertSkipClear(ins);
                 
                 if (me->_clientArgs._enableIcountBreakpoints)
+                {
+                    // The checkpoint check must see the count before this instruction.
+                    //
+                    if (me->CheckpointsActive())
+                        me->InsertCheckpointStop(ins);
                     me->InsertCountingInstrumentation(ins);
+                }
             }
         }
     }
@@ -2239,41 +2794,31 @@ private:
               break;
                 
             case TRIGGER_LOAD_FROM:
-                if (INS_IsMemoryRead(ins))
+                // These are normally checked by InstrumentWatches().  See RebuildWatches().
+                //
+                if (INS_IsMemoryRead(ins) && type == ETYPE_BREAKPOINT && _clientArgs._customInstrumentor)
                 {
-                     INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CheckAddrint,
-                         IARG_CALL_ORDER, _clientArgs._callOrderBefore,
-                         IARG_FAST_ANALYSIS_CALL,
-                         IARG_MEMORYREAD_EA, IARG_ADDRINT, it->second._ea, IARG_END);
-                     if (type == ETYPE_BREAKPOINT)
-                     {
-                         InsertBreakpoint(ins, bbl, TRUE, IPOINT_BEFORE, it->second);
-                         *insertSkipClear = TRUE;
-                     }
-                     else
-                     {
-                         InsertTracepoint(ins, bbl, TRUE, IPOINT_BEFORE, it->first, it->second);
-                     }
+                    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CheckAddrint,
+                        IARG_CALL_ORDER, _clientArgs._callOrderBefore,
+                        IARG_FAST_ANALYSIS_CALL,
+                        IARG_MEMORYREAD_EA, IARG_ADDRINT, it->second._ea, IARG_END);
+                    InsertBreakpoint(ins, bbl, TRUE, IPOINT_BEFORE, it->second);
+                    *insertSkipClear = TRUE;
                 }
                 break;
 
                 
             case TRIGGER_STORE_TO:
-                if (INS_IsMemoryWrite(ins))
+                // These are normally checked by InstrumentWatches().  See RebuildWatches().
+                //
+                if (INS_IsMemoryWrite(ins) && type == ETYPE_BREAKPOINT && _clientArgs._customInstrumentor)
                 {
                     INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CheckAddrint,
                         IARG_CALL_ORDER, _clientArgs._callOrderBefore,
                         IARG_FAST_ANALYSIS_CALL,
                         IARG_MEMORYWRITE_EA, IARG_ADDRINT, it->second._ea, IARG_END);
-                    if (type == ETYPE_BREAKPOINT)
-                    {
-                        InsertBreakpoint(ins, bbl, TRUE, IPOINT_BEFORE, it->second);
-                        *insertSkipClear = TRUE;
-                    }
-                    else
-                    {
-                        InsertTracepoint(ins, bbl, TRUE, IPOINT_BEFORE, it->first, it->second);
-                    }
+                    InsertBreakpoint(ins, bbl, TRUE, IPOINT_BEFORE, it->second);
+                    *insertSkipClear = TRUE;
                 }
                 break;
 
@@ -2336,6 +2881,66 @@ private:
                 break;
             }
         }
+
+        InstrumentWatches(ins, type, insertSkipClear);
+    }
+
+    /*
+     * Instrument a memory instruction with a single check for all the TRIGGER_LOAD_FROM
+     * and TRIGGER_STORE_TO events of one type.
+     *
+     *  @param[in] ins                  Instruction to instrument.
+     *  @param[in] type                 Only check for events of this type.
+     *  @param[out] insertSkipClear     Set TRUE if the instruction needs instrumentation to
+     *                                   clear the REG_SKIP_ONE register.
+     */
+    VOID InstrumentWatches(INS ins, ETYPE type, BOOL *insertSkipClear)
+    {
+        UINT32 loadKinds = (type == ETYPE_BREAKPOINT) ? WATCH_LOAD_BREAK : WATCH_LOAD_TRACE;
+        UINT32 storeKinds = (type == ETYPE_BREAKPOINT) ? WATCH_STORE_BREAK : WATCH_STORE_TRACE;
+        if (!INS_IsMemoryRead(ins) || !(_watchKinds & loadKinds))
+            loadKinds = 0;
+        if (!INS_IsMemoryWrite(ins) || !(_watchKinds & storeKinds))
+            storeKinds = 0;
+        if (!loadKinds && !storeKinds)
+            return;
+
+        // An access that is not checked passes the PC instead of an address, with no
+        // kinds, so the same analysis routines serve loads, stores, and instructions
+        // that do both.
+        //
+        IARG_TYPE loadEa = loadKinds ? IARG_MEMORYREAD_EA : IARG_INST_PTR;
+        IARG_TYPE storeEa = storeKinds ? IARG_MEMORYWRITE_EA : IARG_INST_PTR;
+
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CheckWatchFilter,
+            IARG_CALL_ORDER, _clientArgs._callOrderBefore,
+            IARG_FAST_ANALYSIS_CALL,
+            IARG_PTR, _watchFilter,
+            loadEa, IARG_ADDRINT, static_cast<ADDRINT>(loadKinds),
+            storeEa, IARG_ADDRINT, static_cast<ADDRINT>(storeKinds),
+            IARG_END);
+
+        if (type == ETYPE_BREAKPOINT)
+        {
+            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)TriggerWatchBreakpoint,
+                IARG_CALL_ORDER, _clientArgs._callOrderBefore,
+                IARG_PTR, this,
+                IARG_CONST_CONTEXT, IARG_THREAD_ID,
+                loadEa, IARG_UINT32, loadKinds,
+                storeEa, IARG_UINT32, storeKinds,
+                IARG_END);
+            *insertSkipClear = TRUE;
+        }
+        else
+        {
+            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordWatchTracepoints,
+                IARG_CALL_ORDER, _clientArgs._callOrderBefore,
+                IARG_PTR, this,
+                IARG_CONST_CONTEXT, IARG_INST_PTR,
+                loadEa, IARG_UINT32, loadKinds,
+                storeEa, IARG_UINT32, storeKinds,
+                IARG_END);
+        }
     }
 
     /*
@@ -2389,6 +2994,26 @@ private:
         InsertBreakpoint(ins, bbl, TRUE, IPOINT_BEFORE, evnt);
     }                      
 
+    /*
+     * Instrument an instruction with the check for a checkpoint or restart stop.
+     *
+     *  @param[in] ins  The instruction.
+     */
+    VOID InsertCheckpointStop(INS ins)
+    {
+        ASSERTX(_clientArgs._enableIcountBreakpoints);
+
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CheckIcount,
+                         IARG_CALL_ORDER, _clientArgs._callOrderBefore,
+                         IARG_FAST_ANALYSIS_CALL,
+                         IARG_REG_VALUE, _regThreadData,
+                         IARG_PTR, &_checkpointStop, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)OnCheckpointStop,
+                           IARG_CALL_ORDER, _clientArgs._callOrderBefore,
+                           IARG_PTR, this,
+                           IARG_CONTEXT, IARG_THREAD_ID, IARG_END);
+    }
+
     VOID InsertCountingInstrumentation(INS ins)
     {
         BOOL isMemory = INS_IsMemoryRead(ins) || INS_IsMemoryWrite(ins);
@@ -2812,6 +3437,14 @@ private:
         return (a == b);
     }
 
+    static ADDRINT PIN_FAST_ANALYSIS_CALL CheckWatchFilter(const UINT8 *filter,
+        ADDRINT loadEa, ADDRINT loadKinds, ADDRINT storeEa, ADDRINT storeKinds)
+    {
+        // bit-wise "or" because logical "or" does not produce inline-able code
+        return (filter[(loadEa ^ (loadEa >> 12)) & (WatchFilterSize - 1)] & loadKinds) |
+            (filter[(storeEa ^ (storeEa >> 12)) & (WatchFilterSize - 1)] & storeKinds);
+    }
+
     static ADDRINT PIN_FAST_ANALYSIS_CALL CheckAddressAndValue8(ADDRINT ea, ADDRINT expect, ADDRINT value)
     {
         return (ea == expect) && (*reinterpret_cast<UINT8 *>(ea) == static_cast<UINT8>(value));
@@ -2954,6 +3587,101 @@ private:
     }
 
 
+    /*
+     * Take a checkpoint and / or stop a restarted process when the checkpoint thread
+     * reaches '_checkpointStop'.  Both happen before the state is advanced past this
+     * instruction count, so resuming from the stop does not repeat either one.
+     *
+     *  @param[in] me       Points to our SHELL object.
+     *  @param[in] ctxt     Register state before the instruction.
+     *  @param[in] tid      The calling thread.
+     */
+    static VOID OnCheckpointStop(SHELL *me, CONTEXT *ctxt, THREADID tid)
+    {
+        UINT64 icount = me->_checkpointStop._icount;
+
+        if (me->_checkpointInterval && icount == me->_nextCheckpoint)
+        {
+            me->_nextCheckpoint += me->_checkpointInterval;
+            me->TakeCheckpoint(ctxt, tid, icount);
+        }
+
+        BOOL stop = (me->_hasRestartStop && icount == me->_restartStop);
+        if (stop)
+            me->_hasRestartStop = FALSE;
+        me->UpdateCheckpointStop();
+        if (!stop)
+            return;
+
+        // Nobody is connected to a restarted process yet, so wait for a debugger.
+        //
+        std::ostringstream os;
+        os << "Restarted from checkpoint at icount " << std::dec << me->_restartedFrom <<
+            ", stopped at icount " << icount;
+        PIN_ApplicationBreakpoint(ctxt, tid, TRUE, os.str());
+    }
+
+
+    /*
+     * Trigger the first breakpoint that watches a load or store address.  This is
+     * called only when the watch filter hits, which may be a false positive.
+     *
+     *  @param[in] me           Points to our SHELL object.
+     *  @param[in] ctxt         Register state before the instruction (read-only).
+     *  @param[in] tid          The calling thread.
+     *  @param[in] loadEa       Effective address of the load.
+     *  @param[in] loadKinds    WATCH_KIND bits to check for \a loadEa, or zero.
+     *  @param[in] storeEa      Effective address of the store.
+     *  @param[in] storeKinds   WATCH_KIND bits to check for \a storeEa, or zero.
+     */
+    static VOID TriggerWatchBreakpoint(SHELL *me, CONTEXT *ctxt, THREADID tid,
+        ADDRINT loadEa, UINT32 loadKinds, ADDRINT storeEa, UINT32 storeKinds)
+    {
+        std::vector<const WATCH *> found;
+        me->FindWatches(loadEa, loadKinds, &found);
+        me->FindWatches(storeEa, storeKinds, &found);
+        if (found.empty())
+            return;
+
+        const WATCH *first = *std::min_element(found.begin(), found.end(), CompareWatchIds);
+        TriggerBreakpointBefore(ctxt, tid, static_cast<UINT32>(me->_regSkipOne),
+            first->_event->_triggerMsg.c_str());
+    }
+
+
+    /*
+     * Record all the tracepoints that watch a load or store address.  This is
+     * called only when the watch filter hits, which may be a false positive.
+     *
+     *  @param[in] me           Points to our SHELL object.
+     *  @param[in] ctxt         Register state before the instruction (read-only).
+     *  @param[in] pc           Trigger PC for the tracepoints.
+     *  @param[in] loadEa       Effective address of the load.
+     *  @param[in] loadKinds    WATCH_KIND bits to check for \a loadEa, or zero.
+     *  @param[in] storeEa      Effective address of the store.
+     *  @param[in] storeKinds   WATCH_KIND bits to check for \a storeEa, or zero.
+     */
+    static VOID RecordWatchTracepoints(SHELL *me, CONTEXT *ctxt, ADDRINT pc,
+        ADDRINT loadEa, UINT32 loadKinds, ADDRINT storeEa, UINT32 storeKinds)
+    {
+        std::vector<const WATCH *> found;
+        me->FindWatches(loadEa, loadKinds, &found);
+        me->FindWatches(storeEa, storeKinds, &found);
+        if (found.empty())
+            return;
+        std::sort(found.begin(), found.end(), CompareWatchIds);
+
+        for (std::vector<const WATCH *>::iterator it = found.begin();  it != found.end();  ++it)
+        {
+            const EVENT &evnt = *(*it)->_event;
+            if (REG_valid(evnt._reg))
+                RecordTracepointAndReg(me, (*it)->_id, pc, PIN_GetContextReg(ctxt, evnt._reg));
+            else
+                RecordTracepoint(me, (*it)->_id, pc);
+        }
+    }
+
+
     /*
      * Record a tracepoint with no register value.
      *
@@ -0,0 +1,153 @@
+#!/usr/bin/env python
+# -*- python -*-
+
+'''
+Viewer for the stats segment files written by tools that use
+InstLib/stats_segment.H (e.g. insmix -stats_file, topopcode -stats_file).
+
+It takes a snapshot of the file every interval seconds and prints the
+counters with the highest rate since the previous snapshot. The target
+process is never stopped; each thread slot is read with the seqlock
+protocol described in stats_segment.H.
+
+Example:
+> pin -t insmix.so -stats_file /tmp/mix.stats -- <app> &
+> statsview.py -i 2 -n 20 /tmp/mix.stats
+'''
+
+from __future__ import print_function
+
+import mmap
+import optparse
+import os
+import struct
+import sys
+import time
+
+MAGIC = b'PINSTAT1'
+HEADER = struct.Struct('=8sIIIIQQQQ')
+SLOT_HEADER = struct.Struct('=IIQQ')
+
+# A slot whose seq stays odd this many times, 1 ms apart, was left half
+# written, e.g. because the writer died while publishing it.
+MAX_RETRIES = 1000
+
+
+class Segment(object):
+    def __init__(self, filename):
+        f = open(filename, 'rb')
+        try:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        finally:
+            f.close()
+        (magic, version, self.num_slots, self.num_counters, self.slot_bytes,
+         names_offset, self.slots_offset, self.pid, self.start_us) = \
+            HEADER.unpack_from(self.map, 0)
+        if magic != MAGIC:
+            raise ValueError('%s is not a stats segment' % filename)
+        if version != 1:
+            raise ValueError('unsupported stats segment version %d' % version)
+        names = self.map[names_offset:self.slots_offset].split(b'\0')
+        self.names = [n.decode('ascii', 'replace')
+                      for n in names[:self.num_counters]]
+        self.counters = struct.Struct('=%dQ' % self.num_counters)
+
+    def read_slot(self, slot):
+        '''Return (tid, publishes, time_us, counters) of a consistent copy,
+        or None if no consistent copy could be read.'''
+        off = self.slots_offset + slot * self.slot_bytes
+        for retry in range(MAX_RETRIES):
+            if retry:
+                time.sleep(0.001)
+            seq = struct.unpack_from('=I', self.map, off)[0]
+            if seq & 1:
+                continue
+            raw = self.map[off:off + self.slot_bytes]
+            if struct.unpack_from('=I', self.map, off)[0] != seq:
+                continue
+            _, tid, publishes, time_us = SLOT_HEADER.unpack_from(raw, 0)
+            counters = self.counters.unpack_from(raw, SLOT_HEADER.size)
+            return tid, publishes, time_us, counters
+        print('statsview: skipping slot %d, it is being written' % slot,
+              file=sys.stderr)
+        return None
+
+    def snapshot(self, slots):
+        '''Sum the counters of the selected slots.'''
+        total = [0] * self.num_counters
+        latest = 0
+        threads = 0
+        for slot in slots:
+            copy = self.read_slot(slot)
+            if copy is None:
+                continue
+            tid, publishes, time_us, counters = copy
+            if publishes == 0:
+                continue
+            threads += 1
+            latest = max(latest, time_us)
+            for i, c in enumerate(counters):
+                if c:
+                    total[i] += c
+        return latest, threads, total
+
+
+def show(seg, prev, cur, top):
+    prev_us, _, prev_counts = prev
+    cur_us, threads, cur_counts = cur
+    seconds = (cur_us - prev_us) / 1e6
+    deltas = [(cur_counts[i] - prev_counts[i], i)
+              for i in range(seg.num_counters)
+              if cur_counts[i] != prev_counts[i]]
+    deltas.sort(reverse=True)
+    print('pid %d  threads %d  interval %.3fs' % (seg.pid, threads, seconds))
+    print('%-24s %16s %16s %14s' % ('counter', 'count', 'delta', 'rate/s'))
+    for delta, i in deltas[:top]:
+        rate = delta / seconds if seconds > 0 else 0.0
+        print('%-24s %16d %16d %14.1f'
+              % (seg.names[i], cur_counts[i], delta, rate))
+    print('')
+    sys.stdout.flush()
+
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] <stats file>')
+    parser.add_option('-i', '--interval', type='float', default=1.0,
+                      help='seconds between snapshots')
+    parser.add_option('-n', '--top', type='int', default=20,
+                      help='number of counters to print')
+    parser.add_option('-s', '--slot', type='int', default=-1,
+                      help='only show this slot (default: sum of all)')
+    parser.add_option('--once', action='store_true', default=False,
+                      help='print the current counts once and exit')
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error('expected one stats file')
+    if not os.path.exists(args[0]):
+        parser.error('stats file %s does not exist' % args[0])
+
+    seg = Segment(args[0])
+    if options.slot >= 0:
+        slots = [options.slot]
+    else:
+        slots = range(seg.num_slots)
+
+    empty = (seg.start_us, 0, [0] * seg.num_counters)
+    prev = seg.snapshot(slots)
+    if options.once:
+        show(seg, empty, prev, options.top)
+        return 0
+    try:
+        while True:
+            time.sleep(options.interval)
+            cur = seg.snapshot(slots)
+            if cur[0] != prev[0]:
+                show(seg, prev, cur, options.top)
+                prev = cur
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
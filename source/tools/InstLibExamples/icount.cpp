@@ -42,6 +42,7 @@ INSTLIB::ICOUNT icount;
 VOID Fini(INT32 code, VOID *v)
 {
     std::cerr << "Count " << icount.Count() << endl;
+    std::cerr << "Count (all threads) " << icount.TotalCount() << endl;
     if (KnobReps)
         std::cerr << "Count (single REPs) " << icount.CountWithoutRep() << endl;
 }
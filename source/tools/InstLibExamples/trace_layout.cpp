@@ -0,0 +1,96 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*! @file
+ *  Memory address trace recorded with INSTLIB::TRACE_LAYOUT.
+ *  Produces the same "ip: R/W ea size" lines as pinatrace, without the memory values.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+
+#include "pin.H"
+#include "instlib.H"
+
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+    "o", "trace_layout.out", "specify trace file name");
+
+INSTLIB::TRACE_LAYOUT traceLayout;
+
+std::ofstream TraceFile;
+
+PIN_LOCK traceFileLock;
+
+// Called from the buffer expansion of the thread that made the reference
+VOID RecordMem(THREADID tid, const INSTLIB::TRACE_LAYOUT::REF * ref, ADDRINT ea, VOID * v)
+{
+    PIN_GetLock(&traceFileLock, tid + 1);
+    TraceFile << hex << ref->ip << ": " << (ref->isWrite ? 'W' : 'R') << " "
+              << setw(2+2*sizeof(ADDRINT)) << ea << " "
+              << dec << setw(2) << ref->size << endl;
+    PIN_ReleaseLock(&traceFileLock);
+}
+
+// This function is called when the application exits
+VOID Fini(INT32 code, VOID *v)
+{
+    TraceFile << "#eof" << endl;
+    TraceFile.close();
+}
+
+// argc, argv are the entire command line, including pin -t <toolname> -- ...
+int main(int argc, char * argv[])
+{
+    // Initialize pin
+    if (PIN_Init(argc, argv))
+    {
+        PIN_ERROR("Trace memory references using trace-level buffering.\n"
+                  + KNOB_BASE::StringKnobSummary() + "\n");
+    }
+
+    PIN_InitLock(&traceFileLock);
+    TraceFile.open(KnobOutputFile.Value().c_str());
+    TraceFile.setf(ios::showbase);
+
+    // Activate the memory reference recorder
+    if (!traceLayout.Activate(RecordMem, 0))
+    {
+        PIN_ERROR("Cannot allocate a scratch register.\n");
+    }
+
+    // Register Fini to be called when the application exits
+    PIN_AddFiniFunction(Fini, 0);
+    
+    // Start the program, never returns
+    PIN_StartProgram();
+    
+    return 0;
+}
@@ -48,122 +48,90 @@ END_LEGAL */
 #include <iomanip>
 
 #include "pin.H"
-#include "CallStack.H"
+#include "call-stack.H"
+#include "WatchIndex.H"
 #include "syscall_names.H"
 #include "argv_readparam.h"
 
-///////////////////////// Prototypes //////////////////////////////////////////
-
-const string& Target2RtnName(ADDRINT target);
-const string& Target2LibName(ADDRINT target);
+using namespace CALLSTACK;
 
 ///////////////////////// Global Variables ////////////////////////////////////
 
 ostream *Output;
 
-CallStack callStack(Target2RtnName, Target2LibName);
+CallStackManager *callStacks;
 
 bool main_entry_seen = false;
-bool prevIpDoesPush = FALSE;
 
-set<void *> addrsToDump;
-set<ADDRINT> pushIps;
+WatchIndex watches;
+const UINT8 *watchShadow;   // watches.Shadow(), for the inlined filter
+PIN_LOCK watchLock;
+PIN_LOCK outputLock;
 
 ///////////////////////// Utility functions ///////////////////////////////////
-void RecordPush (INS ins)
-{
-    pushIps.insert(INS_Address (ins));
-}
 
-bool IpDoesPush (ADDRINT ip)
+// Print the call stack of thread tid, innermost first, folding
+// recursion into "(repeated)".
+static void DumpStack(ostream *o, THREADID tid)
 {
-    return (pushIps.find(ip) != pushIps.end());
-}
-
-const string& Target2RtnName(ADDRINT target)
-{
-  const string & name = RTN_FindNameByAddress(target);
-
-  if (name == "")
-      return *new string("[Unknown routine]");
-  else
-      return *new string(name);
-}
-
-const string& Target2LibName(ADDRINT target)
-{
-    PIN_LockClient();
-
-    const RTN rtn = RTN_FindByAddress(target);
-    static const string _invalid_rtn("[Unknown image]");
-
-    string name;
-
-    if( RTN_Valid(rtn) ) {
-        name = IMG_Name(SEC_Img(RTN_Sec(rtn)));
+  static const string unknown("[Unknown routine]");
+  static vector<CallSiteId> sites;  // only used with outputLock held
+  callStacks->stack(tid)->snapshot(sites);
+
+  int level = sites.size() - 1;
+  const string *last = 0;
+  bool repeated = false;
+  bool first = true;
+  for( vector<CallSiteId>::reverse_iterator i = sites.rbegin(); i != sites.rend(); i++ ) {
+    const string& name = callStacks->site_info(*i).func_name;
+    const string& cur = (name == "") ? unknown : name;
+    if( last == 0 || cur != *last ) {
+      if( !first ) {*o << endl;}
+      *o << level << ": " << cur;
     } else {
-        name = _invalid_rtn;
+      if( !repeated ) {
+	*o << "(repeated)";
+      }
+      repeated = true;
     }
-
-    PIN_UnlockClient();
-
-    return *new string(name);
+    first = false;
+    last = &cur;
+    level--;
+  }
+  *o << endl;
 }
 
 ///////////////////////// Analysis Functions //////////////////////////////////
 
+void A_RegisterRange(void *addr, ADDRINT len)
+{
+  PIN_GetLock(&watchLock, 1);
+  watches.Add((ADDRINT)addr, len);
+  PIN_ReleaseLock(&watchLock);
+}
+
 void A_RegisterAddr(void *addr)
 {
-  addrsToDump.insert((void *)addr);
+  A_RegisterRange(addr, 1);
 }
 
 void A_UnregisterAddr(void *addr)
 {
-  if( addrsToDump.find(addr) == addrsToDump.end() ) {
+  PIN_GetLock(&watchLock, 1);
+  bool found = watches.Remove((ADDRINT)addr);
+  PIN_ReleaseLock(&watchLock);
+
+  if( !found ) {
     cerr << "MAID ERROR: unregistered address " << hex << addr << dec << endl;
-  } else {
-    addrsToDump.erase(addr);
   }
 }
 
 
-void ProcessInst (ADDRINT ip)
-{
-    prevIpDoesPush = IpDoesPush (ip);
-}
-
 void A_ProcessSyscall(ADDRINT ip, UINT32 num, ADDRINT sp, ADDRINT arg0)
 {
   if( main_entry_seen ) {
-    //cout << callStack.Depth() << ":" << SYS_SyscallName(num) << endl;
+    //cout << SYS_SyscallName(num) << endl;
   }
-  //callStack.ProcessSysCall(sp, target);
-}
-
-void A_ProcessDirectCall(ADDRINT ip, ADDRINT target, ADDRINT sp)
-{
-  //cout << "Direct call: " << Target2String(target) << endl;
-  callStack.ProcessCall(sp, target);
-}
-
-void A_ProcessIndirectCall(ADDRINT ip, ADDRINT target, ADDRINT sp)
-{
-  //cout << "Indirect call: " << Target2String(target) << endl;
-  callStack.ProcessCall(sp, target);
-}
-
-static void
-A_ProcessStub(ADDRINT ip, ADDRINT target, ADDRINT sp)
-{
-  //cout << "Instrumenting stub: " << Target2String(target) << endl;
-  //cout << "STUB: ";
-  //cout << Target2RtnName(target) << endl;
-  callStack.ProcessCall(sp, target);
-}
-
-static void
-A_ProcessReturn(ADDRINT ip, ADDRINT sp) {
-  callStack.ProcessReturn(sp, prevIpDoesPush);
 }
 
 static void
@@ -173,15 +141,28 @@ A_EnterMainImage(ADDRINT ip, ADDRINT target, ADDRINT sp)
   //assert(current_pc == main_entry_addr);
   //cout << "main" << endl;
   main_entry_seen = true;
-  callStack.ProcessMainEntry(sp, target);
+}
+
+// Inlined before every memory access; the watches are rare, so this
+// almost always returns 0.
+static ADDRINT PIN_FAST_ANALYSIS_CALL
+A_MayTouchWatch(ADDRINT ea)
+{
+  return watchShadow[(ea >> WatchIndex::PAGE_SHIFT) & WatchIndex::SHADOW_MASK];
 }
 
 static void
-A_DoMem(bool isStore, void *ea, ADDRINT pc)
+A_DoMem(bool isStore, void *ea, UINT32 size, ADDRINT pc, THREADID tid)
 {
   string filename;
   int lineno;
-  if( addrsToDump.find(ea) != addrsToDump.end() )
+
+  PIN_GetLock(&watchLock, 1);
+  WatchIndex::Watch watch;
+  bool found = watches.Find((ADDRINT)ea, size, &watch);
+  PIN_ReleaseLock(&watchLock);
+
+  if( found )
   {
     PIN_LockClient();
 
@@ -189,35 +170,25 @@ A_DoMem(bool isStore, void *ea, ADDRINT pc)
 
     PIN_UnlockClient();
 
+    PIN_GetLock(&outputLock, tid + 1);
     *Output << (isStore ? "store" : "load")
 	    << " pc=" << (void*)pc
-	    << " ea=" << ea << endl;
+	    << " ea=" << ea
+	    << " watch=" << (void*)watch.start << "+" << (watch.end - watch.start) << endl;
     if( filename != "") {
       *Output << filename << ":" << lineno;
     } else {
       *Output << "UNKNOWN:0";
     }
     *Output << endl;
-    callStack.DumpStack(Output);
+    DumpStack(Output, tid);
     *Output << endl;
+    PIN_ReleaseLock(&outputLock);
   }
 }
 
 ///////////////////////// Instrumentation functions ///////////////////////////
 
-static BOOL IsPLT(TRACE trace)
-{
-    RTN rtn = TRACE_Rtn(trace);
-
-    // All .plt thunks have a valid RTN
-    if (!RTN_Valid(rtn))
-        return FALSE;
-
-    if (".plt" == SEC_Name(RTN_Sec(rtn)))
-        return TRUE;
-    return FALSE;
-}
-
 static void I_Trace(TRACE trace, void *v)
 {
 
@@ -234,35 +205,29 @@ static void I_Trace(TRACE trace, void *v)
                 || INS_HasMemoryRead2(ins)
                 || INS_IsMemoryWrite(ins)
             ) {
-                INS_InsertCall(ins, IPOINT_BEFORE,
-                               (AFUNPTR)A_DoMem,
-                               IARG_BOOL, INS_IsMemoryWrite(ins),
-                               (INS_IsMemoryWrite(ins) ? IARG_MEMORYWRITE_EA : (INS_IsMemoryRead(ins) ? IARG_MEMORYREAD_EA : IARG_MEMORYREAD2_EA)),
-                               IARG_INST_PTR,
-                               IARG_END);
+                const IARG_TYPE ea = INS_IsMemoryWrite(ins) ? IARG_MEMORYWRITE_EA
+                                   : (INS_IsMemoryRead(ins) ? IARG_MEMORYREAD_EA : IARG_MEMORYREAD2_EA);
+                const IARG_TYPE size = INS_IsMemoryWrite(ins) ? IARG_MEMORYWRITE_SIZE : IARG_MEMORYREAD_SIZE;
+
+                INS_InsertIfCall(ins, IPOINT_BEFORE,
+                                 (AFUNPTR)A_MayTouchWatch,
+                                 IARG_FAST_ANALYSIS_CALL,
+                                 ea,
+                                 IARG_END);
+                INS_InsertThenCall(ins, IPOINT_BEFORE,
+                                   (AFUNPTR)A_DoMem,
+                                   IARG_BOOL, INS_IsMemoryWrite(ins),
+                                   ea,
+                                   size,
+                                   IARG_INST_PTR,
+                                   IARG_THREAD_ID,
+                                   IARG_END);
             }
-#if defined(TARGET_IA32)  && defined (TARGET_WINDOWS)
-            // on ia-32 windows need to identify
-            // push
-            // ret
-            // in order to process callstack correctly
-            if (ins != tail)
-            {
-                INS_InsertPredicatedCall(ins, IPOINT_BEFORE,
-                                         (AFUNPTR)ProcessInst,
-                                         IARG_INST_PTR,
-                                         IARG_END);
-                if (INS_Opcode(ins)==XED_ICLASS_PUSH)
-                {
-                    RecordPush (ins);
-                }
-            }
-#endif
         }
 
 
 
-        // All calls and returns
+        // The calls and returns are tracked by the call stack engine
         if( INS_IsSyscall(tail) ) {
             INS_InsertPredicatedCall(tail, IPOINT_BEFORE,
                                      (AFUNPTR)A_ProcessSyscall,
@@ -271,42 +236,6 @@ static void I_Trace(TRACE trace, void *v)
                                      IARG_REG_VALUE, REG_STACK_PTR,
                                      IARG_SYSCALL_ARG0,
                                      IARG_END);
-
-        } else {
-            if( INS_IsCall(tail) ) {
-                if( INS_IsDirectBranchOrCall(tail) ) {
-                    ADDRINT target = INS_DirectBranchOrCallTargetAddress(tail);
-                    INS_InsertPredicatedCall(tail, IPOINT_BEFORE,
-                                             (AFUNPTR)A_ProcessDirectCall,
-                                             IARG_INST_PTR,
-                                             IARG_ADDRINT, target,
-                                             IARG_REG_VALUE, REG_STACK_PTR,
-                                             IARG_END);
-                } else if( !IsPLT(trace) ) {
-                    INS_InsertPredicatedCall(tail, IPOINT_BEFORE,
-                                             (AFUNPTR)A_ProcessIndirectCall,
-                                             IARG_INST_PTR,
-                                             IARG_BRANCH_TARGET_ADDR,
-                                             IARG_REG_VALUE, REG_STACK_PTR,
-                                             IARG_END);
-                }
-            }
-            if( IsPLT(trace) ) {
-                INS_InsertCall(tail, IPOINT_BEFORE,
-                               (AFUNPTR)A_ProcessStub,
-                               IARG_INST_PTR,
-                               IARG_BRANCH_TARGET_ADDR,
-                               IARG_REG_VALUE, REG_STACK_PTR,
-                               IARG_END);
-            }
-            if( INS_IsRet(tail) ) {
-                INS_InsertPredicatedCall(tail, IPOINT_BEFORE,
-                                         (AFUNPTR)A_ProcessReturn,
-                                         IARG_INST_PTR,
-                                         IARG_REG_VALUE, REG_STACK_PTR,
-                                         IARG_END);
-
-            }
         }
     }
 }
@@ -336,7 +265,19 @@ I_ImageLoad(IMG img, void *v)
   }
 
   for( SYM sym = IMG_RegsymHead(img); SYM_Valid(sym); sym = SYM_Next(sym) ) {
-    if( strstr(SYM_Name(sym).c_str(), "MAID_register_address" ) ) {
+    if( strstr(SYM_Name(sym).c_str(), "MAID_register_range" ) ) {
+      RTN rtn;
+      rtn = RTN_FindByName(img, SYM_Name(sym).c_str());
+      ASSERTX(RTN_Valid(rtn));
+
+      RTN_Open(rtn);
+      RTN_InsertCall(rtn, IPOINT_BEFORE,
+                     (AFUNPTR)A_RegisterRange,
+                     IARG_G_ARG0_CALLEE,
+                     IARG_G_ARG1_CALLEE,
+                     IARG_END);
+      RTN_Close(rtn);
+    } else if( strstr(SYM_Name(sym).c_str(), "MAID_register_address" ) ) {
       RTN rtn;
       rtn = RTN_FindByName(img, SYM_Name(sym).c_str());
       ASSERTX(RTN_Valid(rtn));
@@ -371,6 +312,9 @@ main(int argc, char** argv)
 
   PIN_Init(argc, argv);
   PIN_InitSymbols();
+  PIN_InitLock(&watchLock);
+  PIN_InitLock(&outputLock);
+  watchShadow = watches.Shadow();
 
   if( (strTmp = argv_getString(argc, argv, "--outfile=", NULL)) != NULL ) {
     if( !(Output = new ofstream(strTmp)) ) {
@@ -388,14 +332,22 @@ main(int argc, char** argv)
       perror(s.c_str());
       exit(1);
     }
-    infile >> hex;
-    while( !infile.eof() ) {
-      static void *addr;
-      infile >> addr;
-      addrsToDump.insert((void *)addr);
+    // one watch per line: <address> [<length>]
+    string line;
+    while( getline(infile, line) ) {
+      istringstream fields(line);
+      ADDRINT addr;
+      ADDRINT len = 1;
+      fields >> hex;
+      if( !(fields >> addr) ) continue;
+      fields >> len;
+      watches.Add(addr, len);
     }
   }
 
+  callStacks = CallStackManager::get_instance();
+  callStacks->activate();
+
   IMG_AddInstrumentFunction(I_ImageLoad, 0);
   TRACE_AddInstrumentFunction(I_Trace, 0);
   PIN_StartProgram();
@@ -0,0 +1,173 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+#include <string.h>
+#include "pin.H"
+#include "WatchIndex.H"
+
+///////////////////////////////////////////////////////////////////////////////
+////////// class WatchIndex
+///////////////////////////////////////////////////////////////////////////////
+
+WatchIndex::WatchIndex()
+{
+  _shadow = new UINT8[SHADOW_MASK + 1];
+  memset(_shadow, 0, SHADOW_MASK + 1);
+}
+
+WatchIndex::~WatchIndex()
+{
+  delete [] _shadow;
+}
+
+//
+// An access may start on the page before a watch and run into it, so the
+// shadow also marks that page. A range wider than the shadow marks every
+// slot once. A saturated count is never decremented, it just keeps the
+// page on the slow path.
+//
+VOID
+WatchIndex::Mark(const Watch& w, int delta)
+{
+  const ADDRINT first = Page(w.start);
+  ADDRINT slots = Page(w.end - 1) - first + 3;
+  if( slots > SHADOW_MASK + 1 ) slots = SHADOW_MASK + 1;
+
+  for( ADDRINT i = 0; i < slots; i++ ) {
+    UINT8& count = _shadow[(first - 1 + i) & SHADOW_MASK];
+    if( count != 255 ) count += delta;
+  }
+}
+
+//
+// The exact table is keyed by the pages the watch really covers; Find
+// looks at both ends of the access instead.
+//
+VOID
+WatchIndex::Index(const Watch& w)
+{
+  const ADDRINT first = Page(w.start);
+  const ADDRINT last = Page(w.end - 1);
+
+  if( last - first < MAX_INDEXED_PAGES ) {
+    for( ADDRINT p = first; p <= last; p++ ) {
+      _pages[p].push_back(w);
+    }
+  } else {
+    _ranges.push_back(w);
+  }
+  Mark(w, 1);
+}
+
+VOID
+WatchIndex::Unindex(const Watch& w)
+{
+  const ADDRINT first = Page(w.start);
+  const ADDRINT last = Page(w.end - 1);
+
+  if( last - first >= MAX_INDEXED_PAGES ) {
+    for( vector<Watch>::iterator wi = _ranges.begin(); wi != _ranges.end(); wi++ ) {
+      if( wi->start == w.start ) {
+        _ranges.erase(wi);
+        break;
+      }
+    }
+    Mark(w, -1);
+    return;
+  }
+
+  for( ADDRINT p = first; p <= last; p++ ) {
+    PageMap::iterator it = _pages.find(p);
+    ASSERTX(it != _pages.end());
+    vector<Watch>& watches = it->second;
+    for( vector<Watch>::iterator wi = watches.begin(); wi != watches.end(); wi++ ) {
+      if( wi->start == w.start ) {
+        watches.erase(wi);
+        break;
+      }
+    }
+    if( watches.empty() ) _pages.erase(it);
+  }
+  Mark(w, -1);
+}
+
+VOID
+WatchIndex::Add(ADDRINT start, ADDRINT len)
+{
+  if( len == 0 ) len = 1;
+  Remove(start);
+
+  Watch w;
+  w.start = start;
+  w.end = (start + len < start) ? ~ADDRINT(0) : start + len;
+  _watches[start] = w.end;
+  Index(w);
+}
+
+bool
+WatchIndex::Remove(ADDRINT start)
+{
+  map<ADDRINT, ADDRINT>::iterator it = _watches.find(start);
+  if( it == _watches.end() ) return false;
+
+  Watch w;
+  w.start = it->first;
+  w.end = it->second;
+  _watches.erase(it);
+  Unindex(w);
+  return true;
+}
+
+bool
+WatchIndex::Find(ADDRINT addr, UINT32 size, Watch *found) const
+{
+  const ADDRINT end = addr + (size ? size : 1);
+  const ADDRINT pages[2] = { Page(addr), Page(end - 1) };
+
+  for( int i = 0; i < 2; i++ ) {
+    if( i == 1 && pages[1] == pages[0] ) break;
+    PageMap::const_iterator it = _pages.find(pages[i]);
+    if( it == _pages.end() ) continue;
+    const vector<Watch>& watches = it->second;
+    for( vector<Watch>::const_iterator wi = watches.begin(); wi != watches.end(); wi++ ) {
+      if( addr < wi->end && wi->start < end ) {
+        *found = *wi;
+        return true;
+      }
+    }
+  }
+  for( vector<Watch>::const_iterator wi = _ranges.begin(); wi != _ranges.end(); wi++ ) {
+    if( addr < wi->end && wi->start < end ) {
+      *found = *wi;
+      return true;
+    }
+  }
+  return false;
+}
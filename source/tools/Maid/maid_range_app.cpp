@@ -0,0 +1,71 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*
+ *  Application for the maid_range test. It watches a few ranges with
+ *  MAID_register_range and stores inside and outside of them. MAID should
+ *  report exactly the two stores marked below.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+
+#define NOINLINE __attribute__((noinline))
+
+// MAID instruments these by name.
+extern "C" NOINLINE void MAID_register_range(void *addr, size_t len) { asm volatile(""); }
+extern "C" NOINLINE void MAID_unregister_address(void *addr) { asm volatile(""); }
+
+static char small[64];
+
+int main()
+{
+    volatile char *p = small;
+    MAID_register_range(small + 16, 8);
+    p[0] = 1;
+    p[20] = 1;      // reported, watch=...+8
+    p[24] = 1;      // one past the end of the watch
+    MAID_unregister_address(small + 16);
+    p[20] = 2;
+
+    // Far more pages than MAID indexes one by one
+    const size_t bigSize = 16 * 1024 * 1024;
+    volatile char *big = static_cast<char *>(malloc(bigSize));
+    MAID_register_range((void *)big, bigSize);
+    big[bigSize / 2] = 1;  // reported, watch=...+16777216
+    MAID_unregister_address((void *)big);
+    big[bigSize / 2] = 2;
+    free((void *)big);
+
+    // A length that runs past the end of the address space
+    void *top = reinterpret_cast<void *>(~static_cast<uintptr_t>(0xfff));
+    MAID_register_range(top, ~static_cast<size_t>(0));
+    MAID_unregister_address(top);
+    return 0;
+}
@@ -0,0 +1,717 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*
+ *  This tool tracks every live heap block and reports peak heap usage,
+ *  allocation churn per interval and the call sites that still own memory
+ *  when the application exits.
+ *
+ *  Live blocks are kept in an open addressing table (address -> size,
+ *  call site id, interval of allocation) split into shards, each with its
+ *  own lock. A shard doubles when it is half full, so the cost of a call
+ *  stays bounded no matter how many blocks are live, and each entry takes
+ *  a few words instead of a std::map node.
+ */
+
+#include "pin.H"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "interval_timer.H"
+
+/* ===================================================================== */
+/* Names of the allocation functions */
+/* ===================================================================== */
+#if defined(TARGET_MAC)
+#define MALLOC "_malloc"
+#define CALLOC "_calloc"
+#define REALLOC "_realloc"
+#define FREE "_free"
+#else
+#define MALLOC "malloc"
+#define CALLOC "calloc"
+#define REALLOC "realloc"
+#define FREE "free"
+#endif
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+    "o", "malloctrack.out", "specify output file name");
+
+KNOB<UINT32> KnobInterval(KNOB_MODE_WRITEONCE, "pintool",
+    "interval", "1000", "milliseconds between churn reports (0 disables them)");
+
+KNOB<UINT32> KnobShardBits(KNOB_MODE_WRITEONCE, "pintool",
+    "shard_bits", "6", "log2 of the number of live table shards");
+
+KNOB<UINT32> KnobSiteBits(KNOB_MODE_WRITEONCE, "pintool",
+    "site_bits", "16", "log2 of the number of call sites that are told apart");
+
+KNOB<UINT32> KnobTopSites(KNOB_MODE_WRITEONCE, "pintool",
+    "top", "20", "number of leak sites to print");
+
+/* ===================================================================== */
+/* Live block table */
+/* ===================================================================== */
+
+// One live block. A size that does not fit in 32 bits is stored as
+// BIG_SIZE and kept in the shard's _bigSizes map.
+struct LIVE_ENTRY
+{
+    ADDRINT _addr;
+    UINT32 _size;
+    UINT32 _site;
+    UINT32 _interval;
+};
+
+static const UINT32 BIG_SIZE = 0xffffffff;
+static const UINT64 INITIAL_SHARD_ENTRIES = 1024;
+
+// The fields of a block that was removed from the table.
+struct FREED_BLOCK
+{
+    UINT64 _size;
+    UINT32 _site;
+    UINT32 _interval;
+};
+
+struct SHARD
+{
+    PIN_LOCK _lock;
+    LIVE_ENTRY * _entries;
+    UINT64 _mask;
+    UINT64 _count;
+    std::map<ADDRINT, UINT64> _bigSizes;
+    UINT8 _pad[64];
+};
+
+static SHARD * shards;
+static UINT32 shardShift;
+
+static inline UINT64 HashAddress(ADDRINT addr)
+{
+    return static_cast<UINT64>(addr >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+
+// The top bits of the hash pick the shard.
+static inline SHARD & ShardOf(UINT64 hash)
+{
+    return shards[shardShift == 64 ? 0 : hash >> shardShift];
+}
+
+// The low bits of the product only depend on the low bits of the address,
+// so fold the high half in before masking. Without this, page aligned
+// blocks all land in a few slots.
+static inline UINT64 SlotOf(ADDRINT addr, UINT64 mask)
+{
+    UINT64 hash = HashAddress(addr);
+    return (hash ^ (hash >> 32)) & mask;
+}
+
+static VOID InsertEntry(SHARD & shard, const LIVE_ENTRY & entry)
+{
+    UINT64 slot = SlotOf(entry._addr, shard._mask);
+    while (shard._entries[slot]._addr != 0)
+        slot = (slot + 1) & shard._mask;
+    shard._entries[slot] = entry;
+}
+
+// Double a shard that is half full. Called with the shard lock held.
+static VOID GrowShard(SHARD & shard)
+{
+    LIVE_ENTRY * old = shard._entries;
+    UINT64 oldSize = shard._mask + 1;
+
+    shard._mask = oldSize * 2 - 1;
+    shard._entries = new LIVE_ENTRY[oldSize * 2];
+    memset(shard._entries, 0, sizeof(LIVE_ENTRY) * oldSize * 2);
+    for (UINT64 i = 0; i < oldSize; i++)
+    {
+        if (old[i]._addr != 0)
+            InsertEntry(shard, old[i]);
+    }
+    delete [] old;
+}
+
+static VOID InsertLive(THREADID tid, ADDRINT addr, UINT64 size, UINT32 site, UINT32 interval)
+{
+    LIVE_ENTRY entry;
+    entry._addr = addr;
+    entry._size = (size >= BIG_SIZE) ? BIG_SIZE : static_cast<UINT32>(size);
+    entry._site = site;
+    entry._interval = interval;
+
+    SHARD & shard = ShardOf(HashAddress(addr));
+    PIN_GetLock(&shard._lock, tid+1);
+    if ((shard._count + 1) * 2 > shard._mask + 1)
+        GrowShard(shard);
+    InsertEntry(shard, entry);
+    shard._count++;
+    if (entry._size == BIG_SIZE)
+        shard._bigSizes[addr] = size;
+    PIN_ReleaseLock(&shard._lock);
+}
+
+// Remove a block, closing the gap with backward shift deletion so that the
+// table never needs tombstones.
+static BOOL RemoveLive(THREADID tid, ADDRINT addr, FREED_BLOCK * freed)
+{
+    SHARD & shard = ShardOf(HashAddress(addr));
+    PIN_GetLock(&shard._lock, tid+1);
+
+    UINT64 slot = SlotOf(addr, shard._mask);
+    while (shard._entries[slot]._addr != addr)
+    {
+        if (shard._entries[slot]._addr == 0)
+        {
+            PIN_ReleaseLock(&shard._lock);
+            return FALSE;
+        }
+        slot = (slot + 1) & shard._mask;
+    }
+
+    const LIVE_ENTRY & entry = shard._entries[slot];
+    freed->_size = entry._size;
+    freed->_site = entry._site;
+    freed->_interval = entry._interval;
+    if (entry._size == BIG_SIZE)
+    {
+        freed->_size = shard._bigSizes[addr];
+        shard._bigSizes.erase(addr);
+    }
+
+    UINT64 hole = slot;
+    for (UINT64 next = (hole + 1) & shard._mask; shard._entries[next]._addr != 0;
+         next = (next + 1) & shard._mask)
+    {
+        // An entry may move into the hole only if its home slot is not
+        // between the hole and its current slot.
+        UINT64 home = SlotOf(shard._entries[next]._addr, shard._mask);
+        if (((next - home) & shard._mask) >= ((next - hole) & shard._mask))
+        {
+            shard._entries[hole] = shard._entries[next];
+            hole = next;
+        }
+    }
+    shard._entries[hole]._addr = 0;
+    shard._count--;
+
+    PIN_ReleaseLock(&shard._lock);
+    return TRUE;
+}
+
+/* ===================================================================== */
+/* Call sites */
+/* ===================================================================== */
+
+// Call sites are given small ids so that the live table stays compact. The
+// id is the slot index + 1; id 0 collects the sites that did not fit.
+static volatile ADDRINT * siteAddrs;
+static UINT32 siteMask;
+static const UINT32 MAX_SITE_PROBES = 64;
+
+static UINT32 SiteId(ADDRINT returnIp)
+{
+    UINT32 slot = static_cast<UINT32>(HashAddress(returnIp) >> 32) & siteMask;
+    for (UINT32 i = 0; i < MAX_SITE_PROBES; i++, slot = (slot + 1) & siteMask)
+    {
+        ADDRINT addr = siteAddrs[slot];
+        if (addr == 0)
+        {
+            // Another thread may claim the slot for the same site first
+            if (__sync_bool_compare_and_swap(&siteAddrs[slot], 0, returnIp) || siteAddrs[slot] == returnIp)
+                return slot + 1;
+            continue;
+        }
+        if (addr == returnIp)
+            return slot + 1;
+    }
+    return 0;
+}
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+// Per-thread state, each on its own cache lines. The pending fields carry
+// the arguments of the outermost allocation call to its return; outerSp is
+// the stack pointer at the entry of that call.
+struct THREAD_DATA
+{
+    UINT32 depth;
+    ADDRINT outerSp;
+    UINT32 pendingSite;
+    UINT64 pendingSize;
+    ADDRINT pendingPtr;
+    BOOL pendingTracked;
+    FREED_BLOCK pendingOld;
+    UINT64 allocs;
+    UINT64 frees;
+    UINT64 allocBytes;
+    UINT64 freedBytes;
+    UINT64 unknownFrees;
+    UINT8 pad[64];
+};
+THREAD_DATA threadData[PIN_MAX_THREADS];
+
+// The live byte count is shared so that the peak is exact.
+volatile INT64 liveBytes = 0;
+volatile INT64 peakBytes = 0;
+volatile INT64 intervalPeakBytes = 0;
+volatile UINT32 currentInterval = 0;
+
+std::ofstream TraceFile;
+PIN_THREAD_UID reportThreadUid;
+volatile BOOL reportStop = FALSE;
+
+/* ===================================================================== */
+/* Analysis routines                                                     */
+/* ===================================================================== */
+
+static VOID RaisePeak(volatile INT64 * peak, INT64 value)
+{
+    INT64 old = *peak;
+    while (value > old && !__sync_bool_compare_and_swap(peak, old, value))
+        old = *peak;
+}
+
+static VOID RecordAlloc(THREADID tid, ADDRINT ptr, UINT64 size, UINT32 site)
+{
+    THREAD_DATA & data = threadData[tid];
+    data.allocs++;
+    data.allocBytes += size;
+    InsertLive(tid, ptr, size, site, currentInterval);
+
+    INT64 live = __sync_add_and_fetch(&liveBytes, static_cast<INT64>(size));
+    RaisePeak(&intervalPeakBytes, live);
+    RaisePeak(&peakBytes, live);
+}
+
+static VOID RecordFree(THREADID tid, const FREED_BLOCK & freed)
+{
+    THREAD_DATA & data = threadData[tid];
+    data.frees++;
+    data.freedBytes += freed._size;
+    __sync_sub_and_fetch(&liveBytes, static_cast<INT64>(freed._size));
+}
+
+// The IPOINT_AFTER of an allocation call is missed when the call does not
+// leave through one of its own returns, e.g. a longjmp out of a malloc hook.
+// The depth would then stay non-zero and the thread would stop recording.
+// Code that runs at or above the entry stack pointer of the outermost call
+// is not inside it, so the depth is stale and is dropped.
+static inline VOID DropStaleCall(THREAD_DATA & data, ADDRINT sp)
+{
+    if (data.depth != 0 && sp >= data.outerSp)
+        data.depth = 0;
+}
+
+// Count a call, return TRUE if it is the outermost one
+static inline BOOL EnterCall(THREAD_DATA & data, ADDRINT sp)
+{
+    DropStaleCall(data, sp);
+    if (data.depth++ != 0)
+        return FALSE;
+    data.outerSp = sp;
+    return TRUE;
+}
+
+VOID AllocBefore(THREADID tid, ADDRINT size, ADDRINT returnIp, ADDRINT sp)
+{
+    // Only the outermost call is recorded, e.g. not the malloc() that
+    // realloc() may call internally.
+    THREAD_DATA & data = threadData[tid];
+    if (!EnterCall(data, sp))
+        return;
+    data.pendingSize = size;
+    data.pendingSite = SiteId(returnIp);
+    data.pendingPtr = 0;
+}
+
+VOID CallocBefore(THREADID tid, ADDRINT num, ADDRINT size, ADDRINT returnIp, ADDRINT sp)
+{
+    AllocBefore(tid, static_cast<UINT64>(num) * size, returnIp, sp);
+}
+
+VOID ReallocBefore(THREADID tid, ADDRINT ptr, ADDRINT size, ADDRINT returnIp, ADDRINT sp)
+{
+    THREAD_DATA & data = threadData[tid];
+    if (!EnterCall(data, sp))
+        return;
+    data.pendingSize = size;
+    data.pendingSite = SiteId(returnIp);
+    data.pendingPtr = ptr;
+
+    // Remove the old block before the call, so that another thread cannot
+    // get the same address and insert it first.
+    data.pendingTracked = ptr && RemoveLive(tid, ptr, &data.pendingOld);
+}
+
+VOID AllocAfter(THREADID tid, ADDRINT ret, ADDRINT sp)
+{
+    // The outermost call returns with the stack pointer it was entered
+    // with, the calls inside it return below it. Matching on the stack
+    // pointer also closes the outermost call when an inner return was missed.
+    THREAD_DATA & data = threadData[tid];
+    if (data.depth == 0)
+        return;
+    if (sp < data.outerSp)
+    {
+        if (data.depth > 1)
+            data.depth--;
+        return;
+    }
+    data.depth = 0;
+    if (sp != data.outerSp)
+        return;
+
+    if (data.pendingPtr)
+    {
+        if (ret == 0 && data.pendingSize != 0)
+        {
+            // realloc() failed and the old block is still allocated
+            if (data.pendingTracked)
+                InsertLive(tid, data.pendingPtr, data.pendingOld._size,
+                           data.pendingOld._site, data.pendingOld._interval);
+            return;
+        }
+        if (data.pendingTracked)
+            RecordFree(tid, data.pendingOld);
+        else
+            data.unknownFrees++;
+    }
+    if (ret)
+        RecordAlloc(tid, ret, data.pendingSize, data.pendingSite);
+}
+
+VOID FreeBefore(THREADID tid, ADDRINT ptr, ADDRINT sp)
+{
+    THREAD_DATA & data = threadData[tid];
+    DropStaleCall(data, sp);
+    if (data.depth != 0 || ptr == 0)
+        return;
+
+    FREED_BLOCK freed;
+    if (RemoveLive(tid, ptr, &freed))
+        RecordFree(tid, freed);
+    else
+        data.unknownFrees++;
+}
+
+/* ===================================================================== */
+/* Instrumentation routines                                              */
+/* ===================================================================== */
+
+VOID Image(IMG img, VOID *v)
+{
+    RTN mallocRtn = RTN_FindByName(img, MALLOC);
+    if (RTN_Valid(mallocRtn))
+    {
+        RTN_Open(mallocRtn);
+        RTN_InsertCall(mallocRtn, IPOINT_BEFORE, (AFUNPTR)AllocBefore,
+                       IARG_THREAD_ID,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                       IARG_RETURN_IP,
+                       IARG_REG_VALUE, REG_STACK_PTR,
+                       IARG_END);
+        RTN_InsertCall(mallocRtn, IPOINT_AFTER, (AFUNPTR)AllocAfter,
+                       IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE,
+                       IARG_REG_VALUE, REG_STACK_PTR, IARG_END);
+        RTN_Close(mallocRtn);
+    }
+
+    RTN callocRtn = RTN_FindByName(img, CALLOC);
+    if (RTN_Valid(callocRtn))
+    {
+        RTN_Open(callocRtn);
+        RTN_InsertCall(callocRtn, IPOINT_BEFORE, (AFUNPTR)CallocBefore,
+                       IARG_THREAD_ID,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                       IARG_RETURN_IP,
+                       IARG_REG_VALUE, REG_STACK_PTR,
+                       IARG_END);
+        RTN_InsertCall(callocRtn, IPOINT_AFTER, (AFUNPTR)AllocAfter,
+                       IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE,
+                       IARG_REG_VALUE, REG_STACK_PTR, IARG_END);
+        RTN_Close(callocRtn);
+    }
+
+    RTN reallocRtn = RTN_FindByName(img, REALLOC);
+    if (RTN_Valid(reallocRtn))
+    {
+        RTN_Open(reallocRtn);
+        RTN_InsertCall(reallocRtn, IPOINT_BEFORE, (AFUNPTR)ReallocBefore,
+                       IARG_THREAD_ID,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+                       IARG_RETURN_IP,
+                       IARG_REG_VALUE, REG_STACK_PTR,
+                       IARG_END);
+        RTN_InsertCall(reallocRtn, IPOINT_AFTER, (AFUNPTR)AllocAfter,
+                       IARG_THREAD_ID, IARG_FUNCRET_EXITPOINT_VALUE,
+                       IARG_REG_VALUE, REG_STACK_PTR, IARG_END);
+        RTN_Close(reallocRtn);
+    }
+
+    RTN freeRtn = RTN_FindByName(img, FREE);
+    if (RTN_Valid(freeRtn))
+    {
+        RTN_Open(freeRtn);
+        RTN_InsertCall(freeRtn, IPOINT_BEFORE, (AFUNPTR)FreeBefore,
+                       IARG_THREAD_ID,
+                       IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+                       IARG_REG_VALUE, REG_STACK_PTR,
+                       IARG_END);
+        RTN_Close(freeRtn);
+    }
+}
+
+/* ===================================================================== */
+/* Interval reports                                                      */
+/* ===================================================================== */
+
+// Tool thread that writes the churn of each interval
+VOID ReportThread(VOID *)
+{
+    INSTLIB::INTERVAL_TIMER timer(KnobInterval.Value());
+    UINT64 lastAllocs = 0, lastFrees = 0, lastAllocBytes = 0, lastFreedBytes = 0;
+
+    TraceFile << "# interval allocs frees alloc-bytes freed-bytes live-bytes peak-bytes" << endl;
+    while (timer.Wait(&reportStop))
+    {
+        UINT64 allocs = 0, frees = 0, allocBytes = 0, freedBytes = 0;
+        for (UINT32 i = 0; i < PIN_MAX_THREADS; i++)
+        {
+            allocs += threadData[i].allocs;
+            frees += threadData[i].frees;
+            allocBytes += threadData[i].allocBytes;
+            freedBytes += threadData[i].freedBytes;
+        }
+
+        INT64 live = liveBytes;
+        INT64 peak = intervalPeakBytes;
+        intervalPeakBytes = live;
+        TraceFile << currentInterval
+                  << " " << (allocs - lastAllocs)
+                  << " " << (frees - lastFrees)
+                  << " " << (allocBytes - lastAllocBytes)
+                  << " " << (freedBytes - lastFreedBytes)
+                  << " " << live
+                  << " " << peak << endl;
+        currentInterval++;
+
+        lastAllocs = allocs;
+        lastFrees = frees;
+        lastAllocBytes = allocBytes;
+        lastFreedBytes = freedBytes;
+    }
+}
+
+// Stop the report thread before Fini
+VOID StopReports(VOID *)
+{
+    if (reportStop)
+        return;
+    reportStop = TRUE;
+    PIN_WaitForThreadTermination(reportThreadUid, PIN_INFINITE_TIMEOUT, 0);
+}
+
+/* ===================================================================== */
+
+struct LEAK_SITE
+{
+    UINT32 site;
+    UINT64 blocks;
+    UINT64 bytes;
+    UINT32 oldest;
+};
+
+static BOOL CompareLeakBytes(const LEAK_SITE & a, const LEAK_SITE & b)
+{
+    return a.bytes > b.bytes;
+}
+
+static string SiteName(UINT32 site)
+{
+    if (site == 0)
+        return "<other sites>";
+    ADDRINT addr = siteAddrs[site - 1];
+
+    PIN_LockClient();
+    string name = RTN_FindNameByAddress(addr);
+    IMG img = IMG_FindByAddress(addr);
+    string image = IMG_Valid(img) ? IMG_Name(img) : "";
+    PIN_UnlockClient();
+
+    string::size_type slash = image.find_last_of("/\\");
+    if (slash != string::npos)
+        image = image.substr(slash + 1);
+    return hexstr(addr) + " " + (name.empty() ? "?" : name) + " (" + image + ")";
+}
+
+// Everything that is still in the live table at exit is reported as leaked
+VOID Fini(INT32 code, VOID *v)
+{
+    std::vector<LEAK_SITE> sites(siteMask + 2);
+    for (UINT32 i = 0; i < sites.size(); i++)
+    {
+        sites[i].site = i;
+        sites[i].blocks = 0;
+        sites[i].bytes = 0;
+        sites[i].oldest = currentInterval;
+    }
+
+    UINT64 liveBlocks = 0;
+    UINT32 numShards = 1 << KnobShardBits.Value();
+    for (UINT32 s = 0; s < numShards; s++)
+    {
+        SHARD & shard = shards[s];
+        for (UINT64 i = 0; i <= shard._mask; i++)
+        {
+            const LIVE_ENTRY & entry = shard._entries[i];
+            if (entry._addr == 0)
+                continue;
+            LEAK_SITE & site = sites[entry._site];
+            site.blocks++;
+            site.bytes += (entry._size == BIG_SIZE) ? shard._bigSizes[entry._addr] : entry._size;
+            site.oldest = std::min(site.oldest, entry._interval);
+            liveBlocks++;
+        }
+    }
+    std::sort(sites.begin(), sites.end(), CompareLeakBytes);
+
+    UINT64 allocs = 0, frees = 0, allocBytes = 0, unknownFrees = 0;
+    for (UINT32 i = 0; i < PIN_MAX_THREADS; i++)
+    {
+        allocs += threadData[i].allocs;
+        frees += threadData[i].frees;
+        allocBytes += threadData[i].allocBytes;
+        unknownFrees += threadData[i].unknownFrees;
+    }
+
+    TraceFile << "# allocs " << allocs << " frees " << frees
+              << " alloc-bytes " << allocBytes << endl;
+    TraceFile << "# peak-bytes " << peakBytes << endl;
+    TraceFile << "# leaked-bytes " << liveBytes << " leaked-blocks " << liveBlocks
+              << " unknown-frees " << unknownFrees << endl;
+    TraceFile << "# leak sites: bytes blocks oldest-interval site" << endl;
+    for (UINT32 i = 0; i < sites.size() && i < KnobTopSites.Value(); i++)
+    {
+        if (sites[i].blocks == 0)
+            break;
+        TraceFile << std::setw(14) << sites[i].bytes
+                  << std::setw(10) << sites[i].blocks
+                  << std::setw(8) << sites[i].oldest
+                  << "  " << SiteName(sites[i].site) << endl;
+    }
+    TraceFile << "#eof" << endl;
+    TraceFile.close();
+}
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool tracks live heap blocks and reports peak usage, churn and leaks." << endl;
+    cerr << endl << KNOB_BASE::StringKnobSummary() << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char *argv[])
+{
+    // Initialize pin & symbol manager
+    PIN_InitSymbols();
+    if( PIN_Init(argc,argv) )
+    {
+        return Usage();
+    }
+
+    if (KnobShardBits.Value() > 16 || KnobSiteBits.Value() < 4 || KnobSiteBits.Value() > 24)
+    {
+        cerr << "-shard_bits must be at most 16 and -site_bits between 4 and 24" << endl;
+        return Usage();
+    }
+
+    UINT32 numShards = 1 << KnobShardBits.Value();
+    shardShift = 64 - KnobShardBits.Value();
+    shards = new SHARD[numShards];
+    for (UINT32 s = 0; s < numShards; s++)
+    {
+        PIN_InitLock(&shards[s]._lock);
+        shards[s]._mask = INITIAL_SHARD_ENTRIES - 1;
+        shards[s]._count = 0;
+        shards[s]._entries = new LIVE_ENTRY[INITIAL_SHARD_ENTRIES];
+        memset(shards[s]._entries, 0, sizeof(LIVE_ENTRY) * INITIAL_SHARD_ENTRIES);
+    }
+
+    siteMask = (1 << KnobSiteBits.Value()) - 1;
+    siteAddrs = new ADDRINT[siteMask + 1];
+    memset(const_cast<ADDRINT *>(siteAddrs), 0, sizeof(ADDRINT) * (siteMask + 1));
+
+    // Write to a file since cout and cerr maybe closed by the application
+    TraceFile.open(KnobOutputFile.Value().c_str());
+
+    // Register Image to be called to instrument functions.
+    IMG_AddInstrumentFunction(Image, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    if (KnobInterval.Value() != 0)
+    {
+        if (PIN_SpawnInternalThread(ReportThread, 0, 0, &reportThreadUid) == INVALID_THREADID)
+        {
+            cerr << "failed to start the report thread" << endl;
+            return 1;
+        }
+        PIN_AddPrepareForFiniFunction(StopReports, 0);
+    }
+
+    // Never returns
+    PIN_StartProgram();
+    
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,82 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*
+ * This application leaks LEAKED_BLOCKS blocks of BLOCK_SIZE bytes, all
+ * allocated by LeakBlocks(), and frees everything else it allocates.
+ * malloctrack.test checks that malloctrack reports exactly that leak.
+ */
+#include <stdlib.h>
+
+#define BLOCK_SIZE 100
+#define LEAKED_BLOCKS 10
+#define CHURNED_BLOCKS 50
+
+static void * leaked[LEAKED_BLOCKS];
+
+/* Every block goes through calloc(), realloc() and free() */
+static __attribute__((noinline)) int Churn()
+{
+    int i;
+    for (i = 0; i < CHURNED_BLOCKS; i++)
+    {
+        char * p = (char *)calloc(1, BLOCK_SIZE);
+        char * q;
+        if (p == NULL)
+            return 0;
+        q = (char *)realloc(p, 4 * BLOCK_SIZE);
+        if (q == NULL)
+        {
+            free(p);
+            return 0;
+        }
+        free(q);
+    }
+    return 1;
+}
+
+static __attribute__((noinline)) int LeakBlocks()
+{
+    int i;
+    for (i = 0; i < LEAKED_BLOCKS; i++)
+    {
+        leaked[i] = malloc(BLOCK_SIZE);
+        if (leaked[i] == NULL)
+            return 0;
+    }
+    return 1;
+}
+
+int main()
+{
+    if (!Churn() || !LeakBlocks())
+        return 1;
+    return 0;
+}
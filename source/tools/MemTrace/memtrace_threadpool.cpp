@@ -50,6 +50,15 @@ END_LEGAL */
  * Each application thread has it's own buffer - so multiple application threads do NOT
  * block each other on buffer accesses
  *
+ * By default an application thread whose buffer is full waits until one of its buffers
+ * is returned by the processing threads. When -overload_policy is "drop" or "decimate",
+ * the application thread never waits: if no free buffer is available, the records in the
+ * full buffer are either discarded ("drop") or thinned in place to every Nth record
+ * ("decimate", N is -decimation_rate), and the thread continues filling the same buffer.
+ * Each such overload event leaves a DROP_MARKER MEMREF in the stream, whose ea holds the
+ * number of records dropped since the previous marker, so that consumers can rescale
+ * their statistics.
+ *
  */
 
 #include <cstdio>
@@ -79,6 +88,10 @@ KNOB<UINT32> KnobNumProcessingThreads(KNOB_MODE_OVERWRITE, "pintool", "num_proce
 KNOB<BOOL> KnobStatistics(KNOB_MODE_WRITEONCE, "pintool", "statistics", "0", "gather statistics");
 KNOB<BOOL> KnobLiteStatistics(KNOB_MODE_WRITEONCE, "pintool", "lite_statistics", "0", "gather lite statistics");
 KNOB<string> KnobStatisticsOutputFile(KNOB_MODE_WRITEONCE, "pintool", "stat_file", "memtrace_threadpoolstats.out", "output file");
+KNOB<string> KnobOverloadPolicy(KNOB_MODE_WRITEONCE, "pintool", "overload_policy", "block",
+                                "what to do when no free buffer is available: block, drop or decimate");
+KNOB<UINT32> KnobDecimationRate(KNOB_MODE_WRITEONCE, "pintool", "decimation_rate", "8",
+                                "keep one of every <n> records when -overload_policy is decimate");
 extern "C" UINT64 ReadProcessorCycleCounter();
 
 
@@ -100,6 +113,24 @@ set<PIN_THREAD_UID> uidSet;
 
 const int EMPTY_ENTRY = 0;
 
+/*
+ * The pc of a MEMREF that marks an overload event, its ea is the number of records
+ * that were dropped from this thread's stream since the previous marker
+ */
+const ADDRINT DROP_MARKER = ~ADDRINT(0);
+
+/*
+ * What an application thread does when its buffer is full and no free buffer is available
+ */
+enum OVERLOAD_POLICY
+{
+    OVERLOAD_POLICY_BLOCK,     // wait for a free buffer
+    OVERLOAD_POLICY_DROP,      // discard the records in the full buffer
+    OVERLOAD_POLICY_DECIMATE   // keep one of every KnobDecimationRate records in the full buffer
+};
+
+OVERLOAD_POLICY overloadPolicy = OVERLOAD_POLICY_BLOCK;
+
 
 /* Pin registers that this tool allocates (per-thread) to manage the writing
  * to the per-thread buffer
@@ -142,9 +173,10 @@ class APP_THREAD_REPRESENTITVE
      */
     VOID * CurBufferEnd() { return ((CHAR *)_curBuffer) + KnobNumBytesInBuffer.Value(); }
 
-    VOID * EnqueueFullAndGetNextToFill(VOID *endOfTraceInBuffer, ADDRINT *endOfBuffer);
+    VOID * EnqueueFullAndGetNextToFill(VOID *endOfTraceInBuffer, ADDRINT *endOfBuffer, ADDRINT sizeNeededForThisTraceInBuffer);
 
     VOID * GetFreeBuffer();
+    VOID * TryGetFreeBuffer();
     VOID ReturnFreeBuffer(VOID *buf, THREADID tid);
 
     /*
@@ -168,7 +200,8 @@ class APP_THREAD_REPRESENTITVE
      * The buffer does not have room for this trace, enques the buffer for processing
      * and gets a buffer from the free list to be used as the next buffer to fill
      */
-    static VOID * PIN_FAST_ANALYSIS_CALL BufferFull(VOID *endOfTraceInBuffer, ADDRINT *endOfBuffer, ADDRINT tid);
+    static VOID * PIN_FAST_ANALYSIS_CALL BufferFull(VOID *endOfTraceInBuffer, ADDRINT *endOfBuffer, ADDRINT tid,
+                                                    ADDRINT sizeNeededForThisTraceInBuffer);
 
     /*
      * Analysis routine called at beginning of each trace (after the IF-THEN)-
@@ -188,6 +221,13 @@ class APP_THREAD_REPRESENTITVE
     VOID AllocateFreeBuffers();
     VOID ReclaimFreeBuffers();
 
+    /*
+     * Shed the records of the current buffer according to overloadPolicy, instead of
+     * waiting for a free buffer.
+     * Returns the position in the current buffer from which the filling should continue
+     */
+    VOID * ShedCurrentBuffer(VOID *endOfTraceInBuffer, ADDRINT sizeNeededForThisTraceInBuffer);
+
     /*
      * Return true if position in the buffer is empty
      */
@@ -383,9 +423,15 @@ VOID ProcessBuffer(VOID *curBuf, VOID *endOfTraceInBuffer, APP_THREAD_REPRESENTI
     struct MEMREF * memref = reinterpret_cast<struct MEMREF*>(curBuf);
     struct MEMREF * firstMemref = memref;
     UINT32 i = 0;
+    UINT64 numDropped = 0;
     while (memref < reinterpret_cast<struct MEMREF*>(endOfTraceInBuffer))
     {
-        if (memref->pc!=0)
+        if (memref->pc == DROP_MARKER)
+        {
+           numDropped += memref->ea;
+           memref->pc = 0;
+        }
+        else if (memref->pc!=0)
         {
            i++;
            firstMemref->pc += memref->pc + memref->ea;
@@ -395,6 +441,7 @@ VOID ProcessBuffer(VOID *curBuf, VOID *endOfTraceInBuffer, APP_THREAD_REPRESENTI
     }
 
     associatedAppThread->Statistics()->AddNumElementsProcessed((UINT32)i);
+    associatedAppThread->Statistics()->AddNumDroppedRecordsSeen(numDropped);
     if (KnobStatistics)
     {
         associatedAppThread->Statistics()->UpdateCyclesProcessingBuffer();
@@ -426,12 +473,14 @@ ADDRINT PIN_FAST_ANALYSIS_CALL APP_THREAD_REPRESENTITVE::CheckIfNoSpaceForTraceI
     return (endOfPreviousTraceInBuffer + sizeNeededForThisTraceInBuffer >= bufferEnd);
 }
 
-void * PIN_FAST_ANALYSIS_CALL  APP_THREAD_REPRESENTITVE::BufferFull(VOID *endOfTraceInBuffer, ADDRINT *endOfBuffer, ADDRINT tid)
+void * PIN_FAST_ANALYSIS_CALL  APP_THREAD_REPRESENTITVE::BufferFull(VOID *endOfTraceInBuffer, ADDRINT *endOfBuffer, ADDRINT tid,
+                                                                    ADDRINT sizeNeededForThisTraceInBuffer)
 {
     APP_THREAD_REPRESENTITVE * appThreadRepresentitive
         = static_cast<APP_THREAD_REPRESENTITVE*>(PIN_GetThreadData(appThreadRepresentitiveKey, tid));
     ASSERTX(appThreadRepresentitive != NULL);
-    return (appThreadRepresentitive->EnqueueFullAndGetNextToFill(endOfTraceInBuffer, endOfBuffer));
+    return (appThreadRepresentitive->EnqueueFullAndGetNextToFill(endOfTraceInBuffer, endOfBuffer,
+                                                                 sizeNeededForThisTraceInBuffer));
 }
 
 void * PIN_FAST_ANALYSIS_CALL  APP_THREAD_REPRESENTITVE::AllocateSpaceForTraceInBuffer(CHAR * endOfPreviousTraceInBuffer,
@@ -440,10 +489,24 @@ void * PIN_FAST_ANALYSIS_CALL  APP_THREAD_REPRESENTITVE::AllocateSpaceForTraceIn
     return (endOfPreviousTraceInBuffer + sizeNeededForThisTraceInBuffer);
 }
 
-VOID * APP_THREAD_REPRESENTITVE::EnqueueFullAndGetNextToFill(VOID *endOfTraceInBuffer, ADDRINT *endOfBuffer)
+VOID * APP_THREAD_REPRESENTITVE::EnqueueFullAndGetNextToFill(VOID *endOfTraceInBuffer, ADDRINT *endOfBuffer,
+                                                             ADDRINT sizeNeededForThisTraceInBuffer)
 {
     //printf ("BufferFilled %p\n", _curBuffer);
     //fflush (stdout);
+    VOID * nextBuffer = NULL;
+    if (overloadPolicy != OVERLOAD_POLICY_BLOCK && fullBuffersListManager != NULL)
+    {
+        // Never wait for the processing threads - if none of this thread's buffers is free
+        // then shed the records of the current buffer and continue filling it.
+        // A shed buffer is never processed, so it is not counted as filled.
+        nextBuffer = TryGetFreeBuffer();
+        if (nextBuffer == NULL)
+        {
+            _appThreadStatistics.IncrementNumBuffersShed();
+            return ShedCurrentBuffer(endOfTraceInBuffer, sizeNeededForThisTraceInBuffer);
+        }
+    }
     _appThreadStatistics.IncrementNumBuffersFilled();
 
     // under some conditions the buffer is processed in this app thread
@@ -462,10 +525,14 @@ VOID * APP_THREAD_REPRESENTITVE::EnqueueFullAndGetNextToFill(VOID *endOfTraceInB
     { // process buffer in this app thread
         _appThreadStatistics.IncrementNumBuffersProcessedInAppThread();
         ProcessBuffer(_curBuffer, endOfTraceInBuffer, this);
+        if (nextBuffer != NULL)
+        {
+            ReturnFreeBuffer(nextBuffer, _myTid);
+        }
         return _curBuffer;
     }
 
-    _curBuffer = GetFreeBuffer();
+    _curBuffer = (nextBuffer != NULL) ? nextBuffer : GetFreeBuffer();
     ASSERTX(_curBuffer != NULL);
     *endOfBuffer = (ADDRINT)CurBufferEnd();
 
@@ -473,9 +540,62 @@ VOID * APP_THREAD_REPRESENTITVE::EnqueueFullAndGetNextToFill(VOID *endOfTraceInB
 }
 
 
+VOID * APP_THREAD_REPRESENTITVE::ShedCurrentBuffer(VOID *endOfTraceInBuffer, ADDRINT sizeNeededForThisTraceInBuffer)
+{
+    struct MEMREF * firstMemref = reinterpret_cast<struct MEMREF*>(_curBuffer);
+    struct MEMREF * endMemref = reinterpret_cast<struct MEMREF*>(endOfTraceInBuffer);
+    struct MEMREF * nextToFill = firstMemref;
+    UINT64 numDropped = 0;     // records dropped by this call
+    UINT64 numUnreported = 0;  // records dropped by earlier calls whose marker is folded into this one
+    UINT32 numSeen = 0;
+
+    // Previous markers are always kept, so that no dropped record goes unaccounted
+    for (struct MEMREF * memref = firstMemref; memref < endMemref; memref++)
+    {
+        if (memref->pc == EMPTY_ENTRY)
+        {
+            continue;
+        }
+        MEMREF record = *memref;
+        memref->pc = EMPTY_ENTRY;
+        if (record.pc != DROP_MARKER
+            && (overloadPolicy == OVERLOAD_POLICY_DROP || (numSeen++ % KnobDecimationRate) != 0))
+        {
+            numDropped++;
+            continue;
+        }
+        *nextToFill++ = record;
+    }
+
+    // The next trace and the marker must fit in what is left of the buffer, otherwise
+    // drop everything that is left
+    if (reinterpret_cast<CHAR*>(nextToFill + 1) + sizeNeededForThisTraceInBuffer >= CurBufferEnd())
+    {
+        for (struct MEMREF * memref = firstMemref; memref < nextToFill; memref++)
+        {
+            if (memref->pc == DROP_MARKER)
+            {
+                numUnreported += memref->ea;
+            }
+            else
+            {
+                numDropped++;
+            }
+            memref->pc = EMPTY_ENTRY;
+        }
+        nextToFill = firstMemref;
+    }
+
+    nextToFill->pc = DROP_MARKER;
+    nextToFill->ea = numDropped + numUnreported;
+    _appThreadStatistics.AddNumRecordsDropped(numDropped);
+    return nextToFill + 1;
+}
+
 CHAR * APP_THREAD_REPRESENTITVE::AllocateBuffer()
 {
-    return (new CHAR[KnobNumBytesInBuffer.Value()]);
+    // Unfilled entries must read as EMPTY_ENTRY
+    return (new CHAR[KnobNumBytesInBuffer.Value()]());
 }
 
 VOID * APP_THREAD_REPRESENTITVE::GetFreeBuffer()
@@ -490,6 +610,20 @@ VOID * APP_THREAD_REPRESENTITVE::GetFreeBuffer()
     return buf;
 }
 
+VOID * APP_THREAD_REPRESENTITVE::TryGetFreeBuffer()
+{
+    if (WIND::WaitForSingleObject (_freeBufferSem, 0) != WAIT_OBJECT_0)
+    {
+        return NULL;
+    }
+
+    VOID *endOfTraceInBufferDummy;
+    APP_THREAD_REPRESENTITVE *appThreadRepresentitiveDummy;
+    VOID * buf = freeBuffersListManager.GetBufferFromList(&endOfTraceInBufferDummy, &appThreadRepresentitiveDummy, _myTid);
+    ASSERTX(buf != NULL);
+    return buf;
+}
+
 VOID APP_THREAD_REPRESENTITVE::ReturnFreeBuffer(VOID *buf, THREADID tid)
 {
     freeBuffersListManager.PutBufferOnList(buf, NULL, this, tid);
@@ -734,6 +868,7 @@ VOID TraceAnalysisCalls(TRACE trace, VOID *)
                          IARG_REG_VALUE, endOfTraceInBufferReg,
                          IARG_REG_REFERENCE, endOfBufferReg,
                          IARG_THREAD_ID,
+                         IARG_UINT32, traceAnalysisCallsNeeded.TotalSizeOccupiedByTraceInBuffer(),
                          IARG_RETURN_REGS, endOfTraceInBufferReg,
                          IARG_END);
     TRACE_InsertCall(trace, IPOINT_BEFORE,  AFUNPTR(APP_THREAD_REPRESENTITVE::AllocateSpaceForTraceInBuffer),
@@ -774,6 +909,10 @@ VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
     ASSERTX(appThreadRepresentitive != NULL);
 
     appThreadRepresentitive->Statistics()->DumpNumBuffersFilled();
+    if (overloadPolicy != OVERLOAD_POLICY_BLOCK)
+    {
+        appThreadRepresentitive->Statistics()->DumpOverload(tid);
+    }
     overallStatistics.AccumulateAppThreadStatistics(appThreadRepresentitive->Statistics(), FALSE);
     if (KnobStatistics)
     {
@@ -827,6 +966,10 @@ static VOID PrepareForFini(VOID *v)
 VOID Fini(INT32 code, VOID *v)
 {
     overallStatistics.DumpNumBuffersFilled();
+    if (overloadPolicy != OVERLOAD_POLICY_BLOCK)
+    {
+        overallStatistics.DumpOverload();
+    }
     if (fullBuffersListManager != NULL)
     {
         overallStatistics.IncorporateBufferStatistics(fullBuffersListManager->Statistics(), TRUE);
@@ -900,6 +1043,8 @@ INT32 Usage()
     printf ("-num_processing_threads <num>      :number of internal-tool buffer processing threads to create, default       3\n");
     printf ("-lite_statistics  <0 or 1>         :specify 1 to enable lite statistics gathering,               default       0\n");
     printf ("-heavy_statistics <0 or 1>         :specify 1 to enable heavy statistics gathering,              default       0\n");
+    printf ("-overload_policy <policy>          :block, drop or decimate when no free buffer is available,   default   block\n");
+    printf ("-decimation_rate <num>             :keep one of every <num> records when decimating,             default       8\n");
 
     return -1;
 }
@@ -920,6 +1065,28 @@ int main(int argc, char * argv[])
         return 2;
     }
 
+    if (KnobOverloadPolicy.Value() == "drop")
+    {
+        overloadPolicy = OVERLOAD_POLICY_DROP;
+    }
+    else if (KnobOverloadPolicy.Value() == "decimate")
+    {
+        overloadPolicy = OVERLOAD_POLICY_DECIMATE;
+    }
+    else if (KnobOverloadPolicy.Value() != "block")
+    {
+        printf("Unknown overload_policy %s\n", KnobOverloadPolicy.Value().c_str());
+        fflush (stdout);
+        return Usage();
+    }
+
+    if (overloadPolicy == OVERLOAD_POLICY_DECIMATE && KnobDecimationRate < 2)
+    {
+        printf("Value of knob decimation_rate should be greater than 1\n");
+        fflush (stdout);
+        return 2;
+    }
+
     appThreadRepresentitiveKey = PIN_CreateThreadDataKey(0);
 
     // get the registers to be used in each thread for managing the
@@ -44,6 +44,9 @@ class OVERALL_STATISTICS
           _cyclesProcessingBuffer = 0;
 		  _cyclesWaitingForFreeBuffer = 0;
           _cyclesWaitingForFullBuffer = 0;
+          _numBuffersShed = 0;
+          _numRecordsDropped = 0;
+          _numDroppedRecordsSeen = 0;
 		  _totalCycles = 0;
           if (KnobStatistics)
           {
@@ -75,6 +78,15 @@ class OVERALL_STATISTICS
 		  }
       }
 
+      VOID DumpOverload()
+      {
+          printf ("\n\nOVERALL OVERLOAD STATISTICS\n");
+          printf ("  numBuffersShed                     %14s\n", decstr(_numBuffersShed).c_str());
+          printf ("  numRecordsDropped                  %14s\n", decstr(_numRecordsDropped).c_str());
+          printf ("  numDroppedRecordsSeen              %14s\n", decstr(_numDroppedRecordsSeen).c_str());
+          fflush (stdout);
+      }
+
       VOID Dump()
       {
 
@@ -121,6 +133,9 @@ class OVERALL_STATISTICS
     UINT32 _numBuffersProcessedInAppThread;
     UINT32 _numTimesWaitedForFull;
     UINT32 _numTimesWaitedForFree;
+    UINT64 _numBuffersShed;
+    UINT64 _numRecordsDropped;
+    UINT64 _numDroppedRecordsSeen;
     FILE * _fp;
 } overallStatistics;
 
@@ -159,10 +174,26 @@ class APP_THREAD_STATISTICS
           _numElementsProcessed = 0;
           _cyclesProcessingBuffer = 0;
           _cyclesWaitingForFreeBuffer = 0;
+          _numBuffersShed = 0;
+          _numRecordsDropped = 0;
+          _numDroppedRecordsSeen = 0;
           _totalCycles = 0;
           _startAtCycle = ReadProcessorCycleCounter();
       }
 
+      /*
+       * Records dropped by the application thread itself, and drop markers of this thread
+       * that were seen by the buffer processing. The two agree once all buffers are processed.
+       */
+      VOID DumpOverload(THREADID tid)
+      {
+          printf ("\n\nTHREAD %u OVERLOAD STATISTICS\n", tid);
+          printf ("  numBuffersShed                     %14s\n", decstr(_numBuffersShed).c_str());
+          printf ("  numRecordsDropped                  %14s\n", decstr(_numRecordsDropped).c_str());
+          printf ("  numDroppedRecordsSeen              %14s\n", decstr(_numDroppedRecordsSeen).c_str());
+          fflush (stdout);
+      }
+
       VOID DumpNumBuffersFilled()
       {
           if (!KnobLiteStatistics)
@@ -231,6 +262,12 @@ class APP_THREAD_STATISTICS
       VOID AddNumElementsProcessed(UINT32 numElementsProcessed) {_numElementsProcessed+=numElementsProcessed;}
       VOID IncrementNumBuffersProcessedInAppThread() {_numBuffersProcessedInAppThread++;}
       VOID IncrementNumBuffersFilled() {_numBuffersFilled++;}
+      VOID IncrementNumBuffersShed() {_numBuffersShed++;}
+      VOID AddNumRecordsDropped(UINT64 numRecordsDropped) {_numRecordsDropped+=numRecordsDropped;}
+      VOID AddNumDroppedRecordsSeen(UINT64 numDroppedRecordsSeen) {_numDroppedRecordsSeen+=numDroppedRecordsSeen;}
+      UINT64 NumBuffersShed() {return _numBuffersShed;}
+      UINT64 NumRecordsDropped() {return _numRecordsDropped;}
+      UINT64 NumDroppedRecordsSeen() {return _numDroppedRecordsSeen;}
       UINT32 NumBuffersProcessedInAppThread() {return _numBuffersProcessedInAppThread;}
       UINT64 NumBuffersElementsProcessed() {return _numElementsProcessed;}
       UINT32 NumBuffersFilled() {return _numBuffersFilled;}
@@ -251,6 +288,10 @@ class APP_THREAD_STATISTICS
 
     UINT32 _numTimesWaitedForFree;
     UINT64 _cyclesWaitingForFreeBuffer;
+
+    UINT64 _numBuffersShed;
+    UINT64 _numRecordsDropped;
+    UINT64 _numDroppedRecordsSeen;
 };
 
 VOID OVERALL_STATISTICS::AccumulateAppThreadStatistics (APP_THREAD_STATISTICS *statistics, BOOL accumulateFreeStats)
@@ -258,6 +299,9 @@ VOID OVERALL_STATISTICS::AccumulateAppThreadStatistics (APP_THREAD_STATISTICS *s
     _numElementsProcessed += statistics->NumBuffersElementsProcessed();
     _numBuffersFilled += statistics->NumBuffersFilled();
     _numBuffersProcessedInAppThread += statistics->NumBuffersProcessedInAppThread();
+    _numBuffersShed += statistics->NumBuffersShed();
+    _numRecordsDropped += statistics->NumRecordsDropped();
+    _numDroppedRecordsSeen += statistics->NumDroppedRecordsSeen();
     if (accumulateFreeStats)
     {
         _numTimesWaitedForFree += statistics->NumTimesWaitedForFree();
@@ -47,6 +47,7 @@ END_LEGAL */
 #include <fstream>
 #include <cstdlib>
 #include <map>
+#include <algorithm>
 #include <utility> /* for pair */
 #include <vector>
 #include <unistd.h>
@@ -173,6 +174,11 @@ const UINT32 INDEX_FPNMA_MUL  = INDEX_FMA_BASE + 37;
 
 const UINT32 INDEX_SPECIAL_END   =  INDEX_FMA_BASE + 38;
 
+// One past the largest index any measurement can produce. Iforms are the
+// only indices that can exceed the special rows. Sizes the flat counters.
+const UINT32 INDEX_LIMIT = (static_cast<UINT32>(XED_IFORM_LAST) > INDEX_SPECIAL_END)
+                           ? static_cast<UINT32>(XED_IFORM_LAST) : INDEX_SPECIAL_END;
+
 BOOL IsMemReadIndex(UINT32 i)
 {
     return (INDEX_MEM_READ_SIZE <= i && i < INDEX_MEM_READ_SIZE + MAX_MEM_SIZE );
@@ -377,26 +383,85 @@ typedef UINT64 COUNTER;
 
 /* zero initialized */
 
-typedef map<UINT32,COUNTER> stat_map_t;
+typedef vector<COUNTER> stat_vector_t; // indexed by stat_index_t
 
 class CSTATS
 {
+    // Flat counters indexed by stat_index_t. We remember which rows have
+    // been touched so that clearing and dumping only visit those rows
+    // rather than the whole INDEX_LIMIT range.
   public:
     CSTATS()
+        : unpredicated(INDEX_LIMIT),
+          predicated(INDEX_LIMIT),
+          predicated_true(INDEX_LIMIT),
+          _touched(INDEX_LIMIT)
     {
-        clear();
     }
 
-    stat_map_t unpredicated;
-    stat_map_t predicated;
-    stat_map_t predicated_true;
+    stat_vector_t unpredicated;
+    stat_vector_t predicated;
+    stat_vector_t predicated_true;
+
+    VOID add_unpredicated(stat_index_t i, COUNTER c)
+    {
+        touch(i);
+        unpredicated[i] += c;
+    }
+    VOID add_predicated(stat_index_t i, COUNTER c)
+    {
+        touch(i);
+        predicated[i] += c;
+    }
+    VOID add_predicated_true(stat_index_t i, COUNTER c)
+    {
+        touch(i);
+        predicated_true[i] += c;
+    }
+
+    // add all the rows of another CSTATS to this one
+    VOID merge(const CSTATS& other)
+    {
+        for(vector<stat_index_t>::const_iterator it = other._used.begin(); it != other._used.end(); it++) {
+            stat_index_t i = *it;
+            touch(i);
+            unpredicated[i] += other.unpredicated[i];
+            predicated[i] += other.predicated[i];
+            predicated_true[i] += other.predicated_true[i];
+        }
+    }
+
+    // the touched rows, in ascending index order
+    vector<stat_index_t> used() const
+    {
+        vector<stat_index_t> v(_used);
+        sort(v.begin(), v.end());
+        return v;
+    }
 
     VOID clear()
     {
-        unpredicated.erase(unpredicated.begin(),unpredicated.end());
-        predicated.erase(predicated.begin(),predicated.end());
-        predicated_true.erase(predicated_true.begin(),predicated_true.end());
+        for(vector<stat_index_t>::iterator it = _used.begin(); it != _used.end(); it++) {
+            stat_index_t i = *it;
+            unpredicated[i] = 0;
+            predicated[i] = 0;
+            predicated_true[i] = 0;
+            _touched[i] = 0;
+        }
+        _used.clear();
     }
+
+  private:
+    VOID touch(stat_index_t i)
+    {
+        if (!_touched[i]) {
+            _touched[i] = 1;
+            _used.push_back(i);
+        }
+    }
+
+    vector<UINT8> _touched;
+    vector<stat_index_t> _used;
 };
 
 class BBL_SORT_STATS
@@ -465,14 +530,22 @@ class thread_data_t
 {
   public:
     thread_data_t()
-        : enabled(0)
+        : enabled(0),
+          predicated_true_counts(INDEX_LIMIT),
+          predicated_true_base(INDEX_LIMIT)
     {
     }
-    CSTATS cstats;
-    vector<CSTATS> stats_per_function; // indexed by rtn_num
+    CSTATS cstats;          // rebuilt from the counters on every emit
+    CSTATS function_stats;  // scratch for one function's histogram
     UINT32 enabled;
 
-    vector<COUNTER> block_counts;
+    // The counters only ever increase. zero_stats() snapshots them into
+    // the *_base vectors and the emit code reports the difference, so
+    // neither zeroing nor emitting has to touch per-instruction state.
+    vector<COUNTER> block_counts;          // indexed by block id
+    vector<COUNTER> block_base;
+    stat_vector_t predicated_true_counts;  // indexed by stat_index_t
+    stat_vector_t predicated_true_base;
 
     UINT32 size()
     {
@@ -487,6 +560,19 @@ class thread_data_t
             block_counts.resize(2*n);
     }
 
+    // executions of block i since the last zero_stats()
+    COUNTER block_delta(UINT32 i) const
+    {
+        COUNTER base = (i < block_base.size()) ? block_base[i] : 0;
+        return block_counts[i] - base;
+    }
+
+    VOID snapshot()
+    {
+        block_base = block_counts;
+        predicated_true_base = predicated_true_counts;
+    }
+
 };
 
 thread_data_t* get_tls(THREADID tid)
@@ -603,29 +689,19 @@ VOID PIN_FAST_ANALYSIS_CALL docount_bbl(ADDRINT block_id, THREADID tid)
 }
 
 
-VOID docount_predicated_true(UINT32 index, THREADID tid)
+VOID PIN_FAST_ANALYSIS_CALL docount_predicated_true(UINT32 index, THREADID tid)
 {
     thread_data_t* tdata = get_tls(tid);
-    if (tdata->enabled) {
-        stat_map_t::iterator i = tdata->cstats.predicated_true.find(index);
-        if (i == tdata->cstats.predicated_true.end())
-            tdata->cstats.predicated_true[index] = 1;
-        else
-            i->second += 1;
-    }
+    tdata->predicated_true_counts[index] += tdata->enabled;
 }
 
 /* ===================================================================== */
 
 VOID zero_stats(THREADID tid)
 {
+    // Snapshot rather than clear; the next emit reports counts since now.
     thread_data_t* tdata = get_tls(tid);
-    tdata->cstats.clear();
-    UINT32 limit =  tdata->size();
-    for(UINT32 i=0;i< limit;i++)
-        tdata->block_counts[i]=0;
-    tdata->stats_per_function.erase(  tdata->stats_per_function.begin(),
-                                      tdata->stats_per_function.end());
+    tdata->snapshot();
 }
 /* ===================================================================== */
 
@@ -829,6 +905,7 @@ VOID Trace(TRACE trace, VOID *v)
                 INS_InsertPredicatedCall(ins,
                                          IPOINT_BEFORE,
                                          AFUNPTR(docount_predicated_true),
+                                         IARG_FAST_ANALYSIS_CALL,
                                          IARG_UINT32,
                                          INS_GetIndex(ins),
                                          IARG_THREAD_ID,
@@ -906,44 +983,30 @@ VOID DumpStats(ofstream& out,
     // Compute the "total" bin. Stop at the INDEX_SPECIAL for all histograms
     // except the iform. Iforms do not use the special rows, so we count everything.
 
-    // build a map of the valid stats index values for all 3 tables.
-    map<UINT32, bool> m;
+    // only the touched rows can be nonzero
+    const vector<stat_index_t> m = stats.used();
 
     COUNTER tu=0;
-    for(stat_map_t::iterator it = stats.unpredicated.begin() ;  it != stats.unpredicated.end() ; it++) {
-        if (measurement == measure_iform || it->first < INDEX_SPECIAL)
-            tu += it->second;
-        m[it->first]=true;
-    }
-
     COUNTER tpt=0;
-    for(stat_map_t::iterator it=stats.predicated_true.begin();it != stats.predicated_true.end() ; it++) {
-        if (measurement == measure_iform || it->first < INDEX_SPECIAL)
-            tpt += it->second;
-        m[it->first]=true;
+    for(vector<stat_index_t>::const_iterator it = m.begin(); it != m.end(); it++) {
+        if (measurement == measure_iform || *it < INDEX_SPECIAL) {
+            tu += stats.unpredicated[*it];
+            tpt += stats.predicated_true[*it];
+        }
     }
 
-    for(map<UINT32,bool>::iterator it = m.begin(); it != m.end(); it++) {
-        stat_map_t::iterator s;
-        COUNTER up=0;
-        UINT32 indx = it->first;
-
-        s = stats.unpredicated.find(indx);
-        if (s !=  stats.unpredicated.end())
-            up = s->second;
+    for(vector<stat_index_t>::const_iterator it = m.begin(); it != m.end(); it++) {
+        UINT32 indx = *it;
+        COUNTER up = stats.unpredicated[indx];
 
         if (up == 0)
             continue;
 
         out << ljstr(IndexToString(indx),25) << " " << setw(16) << up;
         if( predicated_true ) {
-            COUNTER prt=0;
-            s = stats.predicated_true.find(indx);
-            if (s !=  stats.predicated_true.end())
-            {
-                prt = s->second;
+            COUNTER prt = stats.predicated_true[indx];
+            if (prt)
                 out << " " << setw(16) << prt;
-            }
         }
         out << endl;
     }
@@ -981,31 +1044,48 @@ VOID emit_bbl_stats_by_function(THREADID tid)
     // the statsList when we do a push_back in the instrumentation.
     PIN_GetLock(&locks.bbl_list_lock,tid+2);
 
-    if (tdata->stats_per_function.size() < functions)
-        tdata->stats_per_function.resize(functions+1);
-
+    // Rebuild the thread histogram from the block deltas, and bucket the
+    // executed blocks by routine (a counting sort) so that each function's
+    // histogram can be built on demand below without a CSTATS per routine.
+    tdata->cstats.clear();
     UINT32 limit = tdata->size();
     if ( limit  > statsList.size() )
         limit = statsList.size();
+    vector<UINT32> rtn_begin(functions+1, 0);
     for(UINT32 i=0;i< limit ; i++)
     {
-        COUNTER bcount = tdata->block_counts[i];
+        COUNTER bcount = tdata->block_delta(i);
         BBLSTATS* b = statsList[i];
         /* the last test below is for when new bbl's get jitted while we
          * are emitting stats */
-        if (b && b->_stats && b->_rtn_num < functions)
+        if (bcount && b && b->_stats && b->_rtn_num < functions) {
             for (const stat_index_t* stats = b->_stats; *stats; stats++) {
-                tdata->cstats.unpredicated[*stats] += bcount;
-                //*out << "# stat for block " << b->_rtn_num << endl;
-                tdata->stats_per_function[b->_rtn_num].unpredicated[*stats] += bcount;
+                tdata->cstats.add_unpredicated(*stats, bcount);
                 if (*stats < INDEX_SPECIAL)
                     rtn_table_sorted[b->_rtn_num]._total += bcount;
             }
+            rtn_begin[b->_rtn_num+1]++;
+        }
+    }
+    for(UINT32 r=0; r<functions; r++)
+        rtn_begin[r+1] += rtn_begin[r];
+    vector<UINT32> rtn_blocks(rtn_begin[functions]);
+    vector<UINT32> rtn_fill(rtn_begin.begin(), rtn_begin.end()-1);
+    for(UINT32 i=0;i< limit ; i++)
+    {
+        BBLSTATS* b = statsList[i];
+        if (tdata->block_delta(i) && b && b->_stats && b->_rtn_num < functions)
+            rtn_blocks[rtn_fill[b->_rtn_num]++] = i;
     }
-
 
     PIN_ReleaseLock(&locks.bbl_list_lock);
 
+    for(UINT32 i=0; i<INDEX_LIMIT; i++) {
+        COUNTER prt = tdata->predicated_true_counts[i] - tdata->predicated_true_base[i];
+        if (prt)
+            tdata->cstats.add_predicated_true(i, prt);
+    }
+
     // emit the "normal" dynamic stats
 
 
@@ -1064,7 +1144,17 @@ VOID emit_bbl_stats_by_function(THREADID tid)
             title += " " + fltstr(pct,3,7) + "%";
             // we sorted, so get the original routine number
             UINT32 rtn_num = rtn_table_sorted[i]._rtn_num;
-            DumpStats(*out, tdata->stats_per_function[rtn_num], KnobProfilePredicated, title,tid);
+            CSTATS& fstats = tdata->function_stats;
+            fstats.clear();
+            PIN_GetLock(&locks.bbl_list_lock,tid+2);
+            for(UINT32 j=rtn_begin[rtn_num]; j<rtn_begin[rtn_num+1]; j++) {
+                UINT32 block = rtn_blocks[j];
+                COUNTER bcount = tdata->block_delta(block);
+                for (const stat_index_t* stats = statsList[block]->_stats; *stats; stats++)
+                    fstats.add_unpredicated(*stats, bcount);
+            }
+            PIN_ReleaseLock(&locks.bbl_list_lock);
+            DumpStats(*out, fstats, KnobProfilePredicated, title,tid);
         }
     }
     *out << "# END_PER_FUNCTION_STATS " <<  endl;
@@ -1102,7 +1192,7 @@ VOID emit_bbl_stats_sorted(THREADID tid)
     {
         BBLSTATS* b = statsList[i];
         if (b) {
-            COUNTER bcount = tdata->block_counts[i];
+            COUNTER bcount = tdata->block_delta(i);
             COUNTER x = b->_ninst;
             x = x * bcount;
             //*out << hex << "ALL PC: " << b->_pc << " COUNT: " << x << endl;
@@ -1184,7 +1274,7 @@ VOID emit_pc_stats(THREADID tid)
         limit = statsList.size();
     for(UINT32 i=0;i< limit ; i++)
     {
-        COUNTER bcount = tdata->block_counts[i];
+        COUNTER bcount = tdata->block_delta(i);
         BBLSTATS* b = statsList[i];
         if (bcount && b && b->_stats)
             *out << "BLOCKCOUNT 0x" << hex << b->_pc  << " " << dec << (bcount * b->_ninst ) << endl;
@@ -1225,31 +1315,7 @@ void combine_dynamic_stats(unsigned int numThreads)
     for (THREADID i=0;i<numThreads; i++)
     {
         thread_data_t* tdata = get_tls(i);
-
-        for(stat_map_t::iterator it = tdata->cstats.unpredicated.begin(); it != tdata->cstats.unpredicated.end() ; it++) {
-            stat_map_t::iterator x = total.unpredicated.find(it->first);
-            if (x == total.unpredicated.end())
-                total.unpredicated[it->first] = it->second;
-            else
-                x->second += it->second;
-        }
-
-        for(stat_map_t::iterator it = tdata->cstats.predicated.begin(); it != tdata->cstats.predicated.end() ; it++) {
-            stat_map_t::iterator x = total.predicated.find(it->first);
-            if (x == total.predicated.end())
-                total.predicated[it->first] = it->second;
-            else
-                x->second += it->second;
-        }
-
-
-        for(stat_map_t::iterator it = tdata->cstats.predicated_true.begin(); it != tdata->cstats.predicated_true.end() ; it++) {
-            stat_map_t::iterator x = total.predicated_true.find(it->first);
-            if (x == total.predicated_true.end())
-                total.predicated_true[it->first] = it->second;
-            else
-                x->second += it->second;
-        }
+        total.merge(tdata->cstats);
     }
 
     *out << "# EMIT_GLOBAL_DYNAMIC_STATS   EMIT# " << stat_dump_count << endl;
@@ -1292,14 +1358,14 @@ VOID Image(IMG img, VOID * v)
                 {
                     for( stat_index_t *start= array; start < end; start++)
                     {
-                        GlobalStatsStatic.predicated[ *start ]++;
+                        GlobalStatsStatic.add_predicated( *start, 1 );
                     }
                 }
                 else
                 {
                     for( stat_index_t *start= array; start < end; start++)
                     {
-                        GlobalStatsStatic.unpredicated[ *start ]++;
+                        GlobalStatsStatic.add_unpredicated( *start, 1 );
                     }
                 }
             }
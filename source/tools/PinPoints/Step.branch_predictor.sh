@@ -30,9 +30,9 @@ else
     exit
 fi
 echo " Find out how the IPF/Linux binary for your program is invoked. "
-echo "(Separate window) Run the program by prefixing it with '`which branch_predictor` -ppfile PathToPintoolPinpointsFile '"
+echo "(Separate window) Run the program by prefixing it with '`which branch_predictor` -regions:in PathToRegionsCsvFile '"
 echo "  e.g. instead of 'hello' invoke your program as "
-echo "      '`which branch_predictor` -ppfile /proj/johndoe/hello.pintool.1.pp -- hello'"
+echo "      '`which branch_predictor` -regions:in /proj/johndoe/hello.pintool.1.csv -- hello'"
 echo " Did your program run with '`which branch_predictor` '?"
 GET_YES_NO
 
@@ -32,12 +32,14 @@ END_LEGAL */
 
 #include "pin.H"
 #include "instlib.H"
-#include "bimodal.H"
+#include "control_manager.H"
+#include "branch_predictors.H"
 
 #define MAXPP 10
-LOCALVAR BIMODAL bimodal;
+LOCALVAR BRANCH_PREDICTORS predictors;
 
 using namespace INSTLIB; 
+using namespace CONTROLLER;
 
 
 
@@ -47,16 +49,17 @@ class PPSTAT{
     public:
         // FIXME: Avoiding floating point arithmatic in analysis routines
         // double ppWeight;
-        UINT32 ppWeightTimesThousand;
-        UINT64 ppMispredicts;
+        UINT32 ppWeightTimesThousand;  // percent of the run times 1000
+        UINT64 ppMispredicts[BRANCH_PREDICTORS::MAX_PREDICTORS];
         UINT64 ppInstructions;
 };
 
 class PPINFO
 {
     public:
-        UINT64 startIcount, startMispredicts;
+        UINT64 startIcount, startMispredicts[BRANCH_PREDICTORS::MAX_PREDICTORS];
         UINT32 currentpp;
+        UINT32 numpp;                  // largest region id seen
         PPSTAT ppstats[MAXPP+1];
 };
 
@@ -69,40 +72,50 @@ using namespace INSTLIB;
 // Track the number of instructions executed
 ICOUNT icount;
 
-// Contains knobs and instrumentation to recognize start/stop points
-CONTROL control;
+// Contains knobs and instrumentation to recognize start/stop points,
+// the PinPoints come from -regions:in
+CONTROL_MANAGER control;
 /* ===================================================================== */
 
-VOID Handler(CONTROL_EVENT ev, VOID * v, CONTEXT * ctxt, VOID * ip, THREADID tid)
+VOID Handler(EVENT_TYPE ev, VOID * v, CONTEXT * ctxt, VOID * ip, THREADID tid, bool bcast)
 {
     std::cout << "ip: " << ip << " Instructions: "  << icount.Count() << " ";
+    predictors.FlushAll(tid);
 
     switch(ev)
     {
-      case CONTROL_START:
+      case EVENT_START:
         std::cout << "Start" << endl;
-        ppinfo.startMispredicts = bimodal.Mispredicts();
+        for (UINT32 p = 0; p < predictors.NumPredictors(); p++)
+        {
+            ppinfo.startMispredicts[p] = predictors.Mispredicts(p);
+        }
         ppinfo.startIcount = icount.Count();
-        if(control.PinPointsActive())
+        if(control.IregionsActive())
         {
-            std::cout << "PinPoint: " << control.CurrentPp() << endl;
-            UINT32 pp = control.CurrentPp();
+            IREGION * region = control.CurrentIregion(tid);
+            UINT32 pp = region->GetRegionId();
+            std::cout << "PinPoint: " << pp << endl;
             ASSERTX( pp <= MAXPP);
-            ppinfo.ppstats[pp].ppWeightTimesThousand = control.CurrentPpWeightTimesThousand();
+            ppinfo.ppstats[pp].ppWeightTimesThousand = region->GetWeightTimesHundredThousand();
             ppinfo.currentpp = pp; 
+            if (pp > ppinfo.numpp)
+                ppinfo.numpp = pp;
         }
         break;
 
-      case CONTROL_STOP:
+      case EVENT_STOP:
         std::cout << "Stop" << endl;
-        if(control.PinPointsActive())
+        if(control.IregionsActive())
         {
-            std::cout << "PinPoint: " << control.CurrentPp() << endl;
-            UINT64 mispredicts = bimodal.Mispredicts() - ppinfo.startMispredicts;
+            std::cout << "PinPoint: " << ppinfo.currentpp << endl;
             UINT64 instructions = icount.Count() - ppinfo.startIcount;
     
             UINT32 pp = ppinfo.currentpp;
-            ppinfo.ppstats[pp].ppMispredicts = mispredicts;
+            for (UINT32 p = 0; p < predictors.NumPredictors(); p++)
+            {
+                ppinfo.ppstats[pp].ppMispredicts[p] = predictors.Mispredicts(p) - ppinfo.startMispredicts[p];
+            }
             ppinfo.ppstats[pp].ppInstructions = instructions;
         }
         break;
@@ -116,7 +129,7 @@ VOID Handler(CONTROL_EVENT ev, VOID * v, CONTEXT * ctxt, VOID * ip, THREADID tid
 INT32 Usage()
 {
     cerr <<
-        "This pin tool is a simple branch predictor \n"
+        "This pin tool simulates a set of branch predictors \n"
         "\n";
 
     cerr << KNOB_BASE::StringKnobSummary() << endl;
@@ -125,23 +138,29 @@ INT32 Usage()
 
 LOCALFUN VOID Fini(int n, void *v)
 {
+    predictors.Flush(PIN_ThreadId());
     *outfile << endl;
-    double whole_MPKI = 1000.0 * (double)bimodal.Mispredicts()/icount.Count();
-    *outfile << "Whole-program MPKI = " << whole_MPKI << dec << endl;
-    if (control.PinPointsActive())
+    for (UINT32 b = 0; b < predictors.NumPredictors(); b++)
     {
-        UINT32 NumPp = control.NumPp();
-        double predicted_MPKI = 0.0;
-        *outfile << "PP #," << " %Weight," << " MPKI" << endl;
-        for (UINT32 p = 1; p <= NumPp ; p++)
+        double whole_MPKI = 1000.0 * (double)predictors.Mispredicts(b)/icount.Count();
+        *outfile << predictors.Name(b) << " Whole-program MPKI = " << whole_MPKI << dec << endl;
+        if (control.IregionsActive())
         {
-            double  weight = (double) ppinfo.ppstats[p].ppWeightTimesThousand/1000.0;
-            double  mpki = (double)ppinfo.ppstats[p].ppMispredicts*1000/ppinfo.ppstats[p].ppInstructions;
-            *outfile << dec << p << ", "  << weight << ", " << mpki << endl;
-            predicted_MPKI +=  (double) weight*mpki/100.0;
+            UINT32 NumPp = ppinfo.numpp;
+            double predicted_MPKI = 0.0;
+            *outfile << "PP #," << " %Weight," << " MPKI" << endl;
+            for (UINT32 p = 1; p <= NumPp ; p++)
+            {
+                double  weight = (double) ppinfo.ppstats[p].ppWeightTimesThousand/1000.0;
+                double  mpki = (double)ppinfo.ppstats[p].ppMispredicts[b]*1000/ppinfo.ppstats[p].ppInstructions;
+                *outfile << dec << p << ", "  << weight << ", " << mpki << endl;
+                predicted_MPKI +=  (double) weight*mpki/100.0;
+            }
+            *outfile << predictors.Name(b) << " Predicted MPKI = " << predicted_MPKI << dec << endl;
         }
-        *outfile << "Predicted MPKI = " << predicted_MPKI << dec << endl;
     }
+    *outfile << endl;
+    predictors.Report(*outfile);
 }
 
 int main(int argc, char *argv[])
@@ -152,11 +171,12 @@ int main(int argc, char *argv[])
     }
 
     icount.Activate();
-    bimodal.Activate();
+    predictors.Activate();
 
 
     // Activate alarm, must be done before PIN_StartProgram
-    control.CheckKnobs(Handler, 0);
+    control.RegisterHandler(Handler, 0, FALSE);
+    control.Activate();
 
 
     outfile = new ofstream("bimodal.out");
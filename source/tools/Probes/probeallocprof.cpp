@@ -0,0 +1,749 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+
+/* ===================================================================== */
+/*! @file
+  Probe mode heap profiler. malloc, calloc, realloc and free are replaced
+  with RTN_ReplaceSignatureProbed so the application runs natively between
+  calls. Each thread keeps its own size-class histogram, per call site
+  (return address) counters and lifetime histogram, so the replacements
+  never take a lock. The only shared structure is an open addressing table
+  of live blocks, updated with compare-and-swap, which lets a free on any
+  thread find the size, call site and allocation time of the block.
+
+  The thread tables are merged and written to the output file when the
+  application calls exit(), and, if -dump_signal is set, whenever the
+  process receives that signal. The signal handler only sets a flag; the
+  dump is written by the next thread that enters one of the replacements.
+
+  Pin does not intercept signals in probe mode, so the handler is installed
+  with the application's own signal() at the first allocation. A handler
+  the application installed before that is still called after ours, but a
+  handler it installs later replaces ours. Pick a signal the application
+  does not use.
+
+  Sample usage:
+    pin -t probeallocprof.so -o heap.prof -dump_signal 12 -- <app>
+    kill -USR2 <pid>         # write a snapshot while the app runs
+ */
+
+#include "pin.H"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include "tool_macros.h"
+
+using namespace std;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
+    "o", "probeallocprof.outfile", "specify profile file name");
+
+KNOB<INT32> KnobDumpSignal(KNOB_MODE_WRITEONCE, "pintool",
+    "dump_signal", "0", "signal that requests a profile dump, e.g. 12 for SIGUSR2 (0 disables)");
+
+KNOB<UINT32> KnobThreadSlots(KNOB_MODE_WRITEONCE, "pintool",
+    "thread_slots", "4096", "number of distinct thread ids that get their own table (a power of 2)");
+
+KNOB<UINT32> KnobTableBits(KNOB_MODE_WRITEONCE, "pintool",
+    "table_bits", "20", "log2 of the number of live blocks that can be tracked");
+
+KNOB<UINT32> KnobTopSites(KNOB_MODE_WRITEONCE, "pintool",
+    "top", "50", "number of call sites to print, ordered by live bytes");
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+typedef VOID * (*FUNCPTR_MALLOC)(size_t);
+typedef VOID * (*FUNCPTR_CALLOC)(size_t, size_t);
+typedef VOID * (*FUNCPTR_REALLOC)(void *, size_t);
+typedef VOID (*FUNCPTR_FREE)(void *);
+typedef VOID (*FUNCPTR_EXIT)(int);
+typedef VOID (*SIGNAL_HANDLER)(int);
+typedef SIGNAL_HANDLER (*FUNCPTR_SIGNAL)(int, SIGNAL_HANDLER);
+
+// Histograms are indexed by the number of significant bits of the value,
+// so class N holds values in [2^(N-1), 2^N).
+static const UINT32 NUM_CLASSES = 65;
+
+// Per thread call site table. Sites that do not fit are summed in
+// THREAD_PROFILE::_otherSites.
+static const UINT32 SITE_SLOTS = 4096;
+static const UINT32 MAX_SITE_PROBES = 32;
+
+static const UINT32 MAX_LIVE_PROBES = 64;
+static const UINT32 MAX_IMAGES = 1024;
+
+struct SITE_STATS
+{
+    ADDRINT _site;
+    UINT64 _allocs;
+    UINT64 _allocBytes;
+    UINT64 _frees;
+    UINT64 _freedBytes;
+    UINT64 _untrackedBytes;   // bytes whose block did not fit in the live table
+    UINT64 _lifetime;         // sum of the lifetimes of the freed blocks
+};
+
+struct THREAD_PROFILE
+{
+    UINT32 _tid;
+    UINT32 _depth;            // non-zero while calling the original allocator
+    UINT64 _sizeCount[NUM_CLASSES];
+    UINT64 _sizeBytes[NUM_CLASSES];
+    UINT64 _lifetimeCount[NUM_CLASSES];
+    UINT64 _untracked;
+    UINT64 _unknownFrees;
+    SITE_STATS _otherSites;
+    SITE_STATS _sites[SITE_SLOTS];
+};
+
+// Threads are found by OS thread id, since neither thread callbacks nor
+// Pin TLS are available in probe mode. A slot is claimed with a CAS on the
+// key and is then written only by the thread that owns it. A recycled
+// thread id continues in the slot of the thread that exited. Calls from
+// threads that find no free slot still keep the live table right, but are
+// not counted.
+static volatile UINT32 * threadKeys;
+static THREAD_PROFILE * volatile * threadProfiles;
+static UINT32 threadMask;
+static volatile UINT64 lostThreadCalls;
+
+// Live block table. _ptr is the key; EMPTY ends a probe sequence and
+// DELETED marks a slot that can be reused.
+static const ADDRINT EMPTY = 0;
+static const ADDRINT DELETED = 1;
+
+struct LIVE_BLOCK
+{
+    volatile ADDRINT _ptr;
+    ADDRINT _site;
+    UINT64 _size;
+    UINT64 _time;
+};
+
+static LIVE_BLOCK * liveBlocks;
+static UINT64 liveMask;
+
+// Images seen so far, used to print call sites as image+offset. An entry is
+// complete before numImages is incremented.
+struct IMAGE_RANGE
+{
+    string _name;
+    ADDRINT _low;
+    ADDRINT _high;
+};
+
+static IMAGE_RANGE images[MAX_IMAGES];
+static volatile UINT32 numImages;
+
+static FUNCPTR_SIGNAL signalFunptr;
+static SIGNAL_HANDLER previousHandler;
+static volatile UINT32 signalInstalled;
+static volatile UINT32 dumpRequested;
+static UINT32 dumpCount;
+static PIN_LOCK dumpLock;
+
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr <<
+        "This pin tool profiles heap allocations in probe mode\n"
+        "\n";
+    cerr << KNOB_BASE::StringKnobSummary();
+    cerr << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+/* Per-thread tables */
+/* ===================================================================== */
+
+static inline UINT64 ReadTimestamp()
+{
+    UINT32 lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return (static_cast<UINT64>(hi) << 32) | lo;
+}
+
+static inline UINT32 ValueClass(UINT64 value)
+{
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+static THREAD_PROFILE * GetThreadProfile()
+{
+    UINT32 tid = PIN_GetTid();
+    UINT32 slot = tid & threadMask;
+    for (UINT32 i = 0; i <= threadMask; i++, slot = (slot + 1) & threadMask)
+    {
+        UINT32 key = threadKeys[slot];
+        if (key == tid)
+            return threadProfiles[slot];
+        if (key == 0 && __sync_bool_compare_and_swap(&threadKeys[slot], 0, tid))
+        {
+            THREAD_PROFILE * profile = new THREAD_PROFILE;
+            memset(profile, 0, sizeof(*profile));
+            profile->_tid = tid;
+            __sync_synchronize();
+            threadProfiles[slot] = profile;
+            return profile;
+        }
+    }
+    __sync_fetch_and_add(&lostThreadCalls, 1);
+    return 0;
+}
+
+static SITE_STATS * FindSite(THREAD_PROFILE * profile, ADDRINT site)
+{
+    UINT32 slot = static_cast<UINT32>((site >> 2) * 0x9E3779B1u) & (SITE_SLOTS - 1);
+    for (UINT32 i = 0; i < MAX_SITE_PROBES; i++, slot = (slot + 1) & (SITE_SLOTS - 1))
+    {
+        SITE_STATS * stats = &profile->_sites[slot];
+        if (stats->_site == site)
+            return stats;
+        if (stats->_site == 0)
+        {
+            stats->_site = site;
+            return stats;
+        }
+    }
+    return &profile->_otherSites;
+}
+
+/* ===================================================================== */
+/* Live block table */
+/* ===================================================================== */
+
+static inline UINT64 LiveSlot(ADDRINT ptr)
+{
+    UINT64 hash = static_cast<UINT64>(ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+    return (hash ^ (hash >> 32)) & liveMask;
+}
+
+// A block is inserted after the original allocator returns it and removed
+// before it is passed to the original free, so the same address is never
+// in the table twice.
+static BOOL InsertLive(ADDRINT ptr, ADDRINT site, UINT64 size, UINT64 time)
+{
+    UINT64 slot = LiveSlot(ptr);
+    for (UINT32 i = 0; i < MAX_LIVE_PROBES; i++, slot = (slot + 1) & liveMask)
+    {
+        LIVE_BLOCK * block = &liveBlocks[slot];
+        ADDRINT key = block->_ptr;
+        if ((key == EMPTY || key == DELETED) && __sync_bool_compare_and_swap(&block->_ptr, key, ptr))
+        {
+            block->_site = site;
+            block->_size = size;
+            block->_time = time;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static BOOL RemoveLive(ADDRINT ptr, LIVE_BLOCK * removed)
+{
+    UINT64 slot = LiveSlot(ptr);
+    for (UINT32 i = 0; i < MAX_LIVE_PROBES; i++, slot = (slot + 1) & liveMask)
+    {
+        LIVE_BLOCK * block = &liveBlocks[slot];
+        ADDRINT key = block->_ptr;
+        if (key == ptr)
+        {
+            removed->_site = block->_site;
+            removed->_size = block->_size;
+            removed->_time = block->_time;
+            __sync_synchronize();
+            block->_ptr = DELETED;
+            return TRUE;
+        }
+        if (key == EMPTY)
+            return FALSE;
+    }
+    return FALSE;
+}
+
+/* ===================================================================== */
+
+static VOID RecordAlloc(THREAD_PROFILE * profile, VOID * ptr, UINT64 size, ADDRINT site)
+{
+    UINT32 sizeClass = ValueClass(size);
+    profile->_sizeCount[sizeClass]++;
+    profile->_sizeBytes[sizeClass] += size;
+
+    SITE_STATS * stats = FindSite(profile, site);
+    stats->_allocs++;
+    stats->_allocBytes += size;
+
+    if (!InsertLive(reinterpret_cast<ADDRINT>(ptr), site, size, ReadTimestamp()))
+    {
+        profile->_untracked++;
+        stats->_untrackedBytes += size;
+    }
+}
+
+static VOID RecordFree(THREAD_PROFILE * profile, const LIVE_BLOCK & block)
+{
+    UINT64 lifetime = ReadTimestamp() - block._time;
+    profile->_lifetimeCount[ValueClass(lifetime)]++;
+
+    // Frees are charged to the allocating call site, in the table of the
+    // thread that frees. The merge adds up all threads.
+    SITE_STATS * stats = FindSite(profile, block._site);
+    stats->_frees++;
+    stats->_freedBytes += block._size;
+    stats->_lifetime += lifetime;
+}
+
+/* ===================================================================== */
+/* Dumping */
+/* ===================================================================== */
+
+struct SITE_TOTAL
+{
+    ADDRINT _site;
+    UINT64 _allocs;
+    UINT64 _allocBytes;
+    UINT64 _frees;
+    UINT64 _freedBytes;
+    UINT64 _untrackedBytes;
+    UINT64 _lifetime;
+
+    INT64 LiveBytes() const
+    {
+        return static_cast<INT64>(_allocBytes - _freedBytes - _untrackedBytes);
+    }
+};
+
+static BOOL CompareLiveBytes(const SITE_TOTAL & a, const SITE_TOTAL & b)
+{
+    if (a.LiveBytes() != b.LiveBytes())
+        return a.LiveBytes() > b.LiveBytes();
+    return a._allocBytes > b._allocBytes;
+}
+
+static VOID AddSite(map<ADDRINT, SITE_TOTAL> & totals, const SITE_STATS & stats)
+{
+    if (stats._allocs == 0 && stats._frees == 0)
+        return;
+    SITE_TOTAL & total = totals[stats._site];
+    total._site = stats._site;
+    total._allocs += stats._allocs;
+    total._allocBytes += stats._allocBytes;
+    total._frees += stats._frees;
+    total._freedBytes += stats._freedBytes;
+    total._untrackedBytes += stats._untrackedBytes;
+    total._lifetime += stats._lifetime;
+}
+
+static string SiteName(ADDRINT site)
+{
+    if (site == 0)
+        return "<other>";
+    UINT32 count = numImages;
+    for (UINT32 i = 0; i < count; i++)
+    {
+        if (site >= images[i]._low && site <= images[i]._high)
+        {
+            string name = images[i]._name;
+            string::size_type slash = name.find_last_of("/\\");
+            if (slash != string::npos)
+                name = name.substr(slash + 1);
+            return name + "+" + hexstr(site - images[i]._low);
+        }
+    }
+    return hexstr(site);
+}
+
+static VOID WriteHistogram(ofstream & out, const char * title, const UINT64 * counts,
+                           const UINT64 * bytes)
+{
+    out << "# " << title << endl;
+    for (UINT32 i = 0; i < NUM_CLASSES; i++)
+    {
+        if (counts[i] == 0)
+            continue;
+        UINT64 high = (i == 0) ? 0 : (i == 64) ? ~UINT64(0) : (UINT64(1) << i) - 1;
+        out << setw(22) << high << setw(14) << counts[i];
+        if (bytes)
+            out << setw(18) << bytes[i];
+        out << endl;
+    }
+}
+
+// Merge all thread tables and append one profile to the output file. Other
+// threads keep running, so a snapshot taken on a signal is approximate.
+static VOID WriteProfile(const char * reason)
+{
+    PIN_GetLock(&dumpLock, PIN_GetTid());
+
+    UINT64 sizeCount[NUM_CLASSES] = {0};
+    UINT64 sizeBytes[NUM_CLASSES] = {0};
+    UINT64 lifetimeCount[NUM_CLASSES] = {0};
+    UINT64 untracked = 0;
+    UINT64 unknownFrees = 0;
+    UINT32 threads = 0;
+    map<ADDRINT, SITE_TOTAL> totals;
+
+    for (UINT32 slot = 0; slot <= threadMask; slot++)
+    {
+        const THREAD_PROFILE * profile = threadProfiles[slot];
+        if (!profile)
+            continue;
+        threads++;
+        for (UINT32 i = 0; i < NUM_CLASSES; i++)
+        {
+            sizeCount[i] += profile->_sizeCount[i];
+            sizeBytes[i] += profile->_sizeBytes[i];
+            lifetimeCount[i] += profile->_lifetimeCount[i];
+        }
+        untracked += profile->_untracked;
+        unknownFrees += profile->_unknownFrees;
+        AddSite(totals, profile->_otherSites);
+        for (UINT32 i = 0; i < SITE_SLOTS; i++)
+        {
+            if (profile->_sites[i]._site != 0)
+                AddSite(totals, profile->_sites[i]);
+        }
+    }
+
+    vector<SITE_TOTAL> sites;
+    for (map<ADDRINT, SITE_TOTAL>::const_iterator it = totals.begin(); it != totals.end(); ++it)
+        sites.push_back(it->second);
+    sort(sites.begin(), sites.end(), CompareLiveBytes);
+
+    ofstream out(KnobOutputFile.Value().c_str(), dumpCount == 0 ? ios::out : ios::app);
+    dumpCount++;
+    out << "# profile " << dumpCount << " (" << reason << ")" << endl;
+    out << "# threads " << threads << " call-sites " << sites.size() << endl;
+    WriteHistogram(out, "size class: max-bytes allocs bytes", sizeCount, sizeBytes);
+    WriteHistogram(out, "lifetime: max-cycles frees", lifetimeCount, 0);
+
+    out << "# sites by live bytes: site allocs alloc-bytes frees freed-bytes live-bytes avg-lifetime" << endl;
+    UINT32 top = KnobTopSites.Value();
+    for (UINT32 i = 0; i < sites.size() && i < top; i++)
+    {
+        const SITE_TOTAL & site = sites[i];
+        out << setw(40) << left << SiteName(site._site) << right
+            << setw(12) << site._allocs
+            << setw(16) << site._allocBytes
+            << setw(12) << site._frees
+            << setw(16) << site._freedBytes
+            << setw(16) << site.LiveBytes()
+            << setw(14) << (site._frees ? site._lifetime / site._frees : 0) << endl;
+    }
+    out << "# untracked-blocks " << untracked << " unknown-frees " << unknownFrees
+        << " lost-thread-calls " << lostThreadCalls << endl;
+    out << "#eof" << endl;
+    out.close();
+
+    PIN_ReleaseLock(&dumpLock);
+}
+
+static VOID DumpSignalHandler(int sig)
+{
+    dumpRequested = 1;
+
+    // Chain to a handler the application installed, but not to SIG_DFL,
+    // SIG_IGN or SIG_ERR.
+    ADDRINT previous = reinterpret_cast<ADDRINT>(previousHandler);
+    if (previous > 1 && previous != ADDRINT(-1))
+        previousHandler(sig);
+}
+
+// Called on every replacement. Installs the signal handler from the first
+// application thread that allocates, and writes a requested dump outside
+// of signal context.
+static inline VOID CheckDumpRequest()
+{
+    if (!signalInstalled && signalFunptr && __sync_bool_compare_and_swap(&signalInstalled, 0, 1))
+        previousHandler = signalFunptr(KnobDumpSignal.Value(), DumpSignalHandler);
+    if (dumpRequested && __sync_bool_compare_and_swap(&dumpRequested, 1, 0))
+        WriteProfile("signal");
+}
+
+/* ===================================================================== */
+/* Replacement routines */
+/* ===================================================================== */
+
+VOID * Probe_Malloc(FUNCPTR_MALLOC orgFuncptr, size_t size, ADDRINT returnIp)
+{
+    THREAD_PROFILE * profile = GetThreadProfile();
+    if (!profile || profile->_depth)
+        return orgFuncptr(size);
+
+    profile->_depth++;
+    VOID * ptr = orgFuncptr(size);
+    profile->_depth--;
+
+    if (ptr)
+        RecordAlloc(profile, ptr, size, returnIp);
+    CheckDumpRequest();
+    return ptr;
+}
+
+VOID * Probe_Calloc(FUNCPTR_CALLOC orgFuncptr, size_t num, size_t size, ADDRINT returnIp)
+{
+    THREAD_PROFILE * profile = GetThreadProfile();
+    if (!profile || profile->_depth)
+        return orgFuncptr(num, size);
+
+    profile->_depth++;
+    VOID * ptr = orgFuncptr(num, size);
+    profile->_depth--;
+
+    if (ptr)
+        RecordAlloc(profile, ptr, static_cast<UINT64>(num) * size, returnIp);
+    CheckDumpRequest();
+    return ptr;
+}
+
+VOID * Probe_Realloc(FUNCPTR_REALLOC orgFuncptr, void * ptr, size_t size, ADDRINT returnIp)
+{
+    THREAD_PROFILE * profile = GetThreadProfile();
+    if (profile && profile->_depth)
+        return orgFuncptr(ptr, size);
+
+    // The old block leaves the live table even if this thread has no
+    // table, or a later block at the same address would find it.
+    LIVE_BLOCK old;
+    BOOL tracked = ptr && RemoveLive(reinterpret_cast<ADDRINT>(ptr), &old);
+
+    if (profile)
+        profile->_depth++;
+    VOID * newPtr = orgFuncptr(ptr, size);
+    if (profile)
+        profile->_depth--;
+
+    if (!newPtr && size != 0)
+    {
+        // The old block is still allocated.
+        if (tracked)
+            InsertLive(reinterpret_cast<ADDRINT>(ptr), old._site, old._size, old._time);
+        return newPtr;
+    }
+    if (!profile)
+        return newPtr;
+
+    if (tracked)
+        RecordFree(profile, old);
+    else if (ptr)
+        profile->_unknownFrees++;
+    if (newPtr)
+        RecordAlloc(profile, newPtr, size, returnIp);
+    CheckDumpRequest();
+    return newPtr;
+}
+
+VOID Probe_Free(FUNCPTR_FREE orgFuncptr, void * ptr)
+{
+    THREAD_PROFILE * profile = GetThreadProfile();
+    if (!ptr || (profile && profile->_depth))
+    {
+        orgFuncptr(ptr);
+        return;
+    }
+
+    // Always remove the block, so that the same address is never in the
+    // live table twice; only the accounting needs a thread table.
+    LIVE_BLOCK block;
+    BOOL tracked = RemoveLive(reinterpret_cast<ADDRINT>(ptr), &block);
+    if (!profile)
+    {
+        orgFuncptr(ptr);
+        return;
+    }
+
+    if (tracked)
+        RecordFree(profile, block);
+    else
+        profile->_unknownFrees++;
+
+    profile->_depth++;
+    orgFuncptr(ptr);
+    profile->_depth--;
+    CheckDumpRequest();
+}
+
+VOID Probe_Exit(FUNCPTR_EXIT orgFuncptr, int code)
+{
+    WriteProfile("exit");
+    orgFuncptr(code);
+}
+
+/* ===================================================================== */
+/* Instrumentation */
+/* ===================================================================== */
+
+static VOID ReplaceAllocator(IMG img, const char * name, AFUNPTR replacement, PROTO proto,
+                             UINT32 numArgs)
+{
+    RTN rtn = RTN_FindByName(img, C_MANGLE(name));
+    if (!RTN_Valid(rtn) || !RTN_IsSafeForProbedReplacement(rtn))
+    {
+        PROTO_Free(proto);
+        return;
+    }
+
+    if (numArgs == 1)
+    {
+        RTN_ReplaceSignatureProbed(rtn, replacement,
+            IARG_PROTOTYPE, proto,
+            IARG_ORIG_FUNCPTR,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_RETURN_IP,
+            IARG_END);
+    }
+    else
+    {
+        RTN_ReplaceSignatureProbed(rtn, replacement,
+            IARG_PROTOTYPE, proto,
+            IARG_ORIG_FUNCPTR,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 1,
+            IARG_RETURN_IP,
+            IARG_END);
+    }
+}
+
+// Called every time a new image is loaded.
+// Look for routines that we want to replace.
+VOID ImageLoad(IMG img, VOID *v)
+{
+    if (numImages < MAX_IMAGES)
+    {
+        IMAGE_RANGE & range = images[numImages];
+        range._name = IMG_Name(img);
+        range._low = IMG_LowAddress(img);
+        range._high = IMG_HighAddress(img);
+        __sync_synchronize();
+        numImages++;
+    }
+
+    ReplaceAllocator(img, "malloc", AFUNPTR(Probe_Malloc),
+        PROTO_Allocate(PIN_PARG(void *), CALLINGSTD_DEFAULT, "malloc",
+                       PIN_PARG(size_t), PIN_PARG_END()), 1);
+    ReplaceAllocator(img, "calloc", AFUNPTR(Probe_Calloc),
+        PROTO_Allocate(PIN_PARG(void *), CALLINGSTD_DEFAULT, "calloc",
+                       PIN_PARG(size_t), PIN_PARG(size_t), PIN_PARG_END()), 2);
+    ReplaceAllocator(img, "realloc", AFUNPTR(Probe_Realloc),
+        PROTO_Allocate(PIN_PARG(void *), CALLINGSTD_DEFAULT, "realloc",
+                       PIN_PARG(void *), PIN_PARG(size_t), PIN_PARG_END()), 2);
+
+    RTN freeRtn = RTN_FindByName(img, C_MANGLE("free"));
+    if (RTN_Valid(freeRtn) && RTN_IsSafeForProbedReplacement(freeRtn))
+    {
+        PROTO proto_free = PROTO_Allocate(PIN_PARG(void), CALLINGSTD_DEFAULT,
+                                          "free", PIN_PARG(void *), PIN_PARG_END());
+        RTN_ReplaceSignatureProbed(freeRtn, AFUNPTR(Probe_Free),
+            IARG_PROTOTYPE, proto_free,
+            IARG_ORIG_FUNCPTR,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_END);
+    }
+
+    RTN exitRtn = RTN_FindByName(img, C_MANGLE("exit"));
+    if (RTN_Valid(exitRtn) && RTN_IsSafeForProbedReplacement(exitRtn))
+    {
+        PROTO proto_exit = PROTO_Allocate(PIN_PARG(void), CALLINGSTD_DEFAULT,
+                                          "exit", PIN_PARG(int), PIN_PARG_END());
+        RTN_ReplaceSignatureProbed(exitRtn, AFUNPTR(Probe_Exit),
+            IARG_PROTOTYPE, proto_exit,
+            IARG_ORIG_FUNCPTR,
+            IARG_FUNCARG_ENTRYPOINT_VALUE, 0,
+            IARG_END);
+    }
+
+    // The handler is installed through the application's own signal(),
+    // since Pin does not intercept signals in probe mode.
+    if (KnobDumpSignal.Value() != 0 && !signalFunptr)
+    {
+        RTN signalRtn = RTN_FindByName(img, C_MANGLE("signal"));
+        if (RTN_Valid(signalRtn))
+            signalFunptr = reinterpret_cast<FUNCPTR_SIGNAL>(RTN_Funptr(signalRtn));
+    }
+}
+
+/* ===================================================================== */
+
+int main(int argc, CHAR *argv[])
+{
+    PIN_InitSymbols();
+
+    if (PIN_Init(argc, argv))
+    {
+        return Usage();
+    }
+
+    UINT32 bits = KnobTableBits.Value();
+    if (bits < 4 || bits > 30)
+    {
+        cerr << "-table_bits must be between 4 and 30" << endl;
+        return Usage();
+    }
+    UINT32 threadSlots = KnobThreadSlots.Value();
+    if (threadSlots == 0 || (threadSlots & (threadSlots - 1)) != 0)
+    {
+        cerr << "-thread_slots must be a power of 2" << endl;
+        return Usage();
+    }
+    threadMask = threadSlots - 1;
+    threadKeys = new UINT32[threadSlots];
+    threadProfiles = new THREAD_PROFILE *[threadSlots];
+    memset(const_cast<UINT32 *>(threadKeys), 0, sizeof(UINT32) * threadSlots);
+    memset(const_cast<THREAD_PROFILE **>(threadProfiles), 0, sizeof(THREAD_PROFILE *) * threadSlots);
+
+    liveMask = (UINT64(1) << bits) - 1;
+    liveBlocks = new LIVE_BLOCK[liveMask + 1];
+    memset(liveBlocks, 0, sizeof(LIVE_BLOCK) * (liveMask + 1));
+
+    PIN_InitLock(&dumpLock);
+
+    IMG_AddInstrumentFunction(ImageLoad, 0);
+
+    PIN_StartProgramProbed();
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
@@ -0,0 +1,92 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*
+ * This application allocates NUM_BLOCKS blocks of BLOCK_SIZE bytes in
+ * AllocBlocks() and frees them from another thread and from main. Half
+ * way it raises SIGUSR2, which probeallocprof.test passes as -dump_signal,
+ * so the tool writes one profile for the signal and one at exit:
+ *
+ *   signal: 33 frees, (64 - 33) * 1000 = 31000 live bytes at the site
+ *   exit:   48 frees, (64 - 48) * 1000 = 16000 live bytes at the site
+ *
+ * The dump is written by the first allocator call after the signal, the
+ * free() of blocks[FREED_BY_THREAD], so nothing else may allocate or free
+ * between raise() and that call.
+ */
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define BLOCK_SIZE 1000
+#define NUM_BLOCKS 64
+#define FREED_BY_THREAD 32
+#define FREED_AT_EXIT 48
+
+static void * blocks[NUM_BLOCKS];
+
+/* The only allocation site of this image */
+static __attribute__((noinline)) int AllocBlocks()
+{
+    int i;
+    for (i = 0; i < NUM_BLOCKS; i++)
+    {
+        blocks[i] = malloc(BLOCK_SIZE);
+        if (blocks[i] == NULL)
+            return 0;
+    }
+    return 1;
+}
+
+static void * FreeBlocks(void * arg)
+{
+    int i;
+    for (i = 0; i < FREED_BY_THREAD; i++)
+        free(blocks[i]);
+    return 0;
+}
+
+int main()
+{
+    pthread_t tid;
+    int i;
+
+    if (!AllocBlocks())
+        return 1;
+    if (pthread_create(&tid, 0, FreeBlocks, 0) != 0)
+        return 1;
+    pthread_join(tid, 0);
+
+    raise(SIGUSR2);
+
+    for (i = FREED_BY_THREAD; i < FREED_AT_EXIT; i++)
+        free(blocks[i]);
+    return 0;
+}
@@ -33,9 +33,12 @@ END_LEGAL */
  */
 
 #include "pin.H"
+#include "flight_recorder.H"
 #include <iostream>
 #include <fstream>
 
+using namespace INSTLIB;
+
 /* ===================================================================== */
 /* Global Variables */
 /* ===================================================================== */
@@ -48,6 +51,8 @@ std::ofstream TraceFile;
 
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "calltrace.out", "specify trace file name");
 KNOB<BOOL>   KnobPrintArgs(KNOB_MODE_WRITEONCE, "pintool", "a", "0", "print call arguments ");
+KNOB<UINT32> KnobFlightRecorder(KNOB_MODE_WRITEONCE, "pintool", "flight_recorder", "0",
+                                "only keep the last n calls of each thread and write them on a fatal signal or at exit");
 //KNOB<BOOL>   KnobPrintArgs(KNOB_MODE_WRITEONCE, "pintool", "i", "0", "mark indirect calls ");
 
 /* ===================================================================== */
@@ -63,6 +68,8 @@ INT32 Usage()
 
 string invalid = "invalid_rtn";
 
+FLIGHT_RECORDER recorder;
+
 /* ===================================================================== */
 const string *Target2String(ADDRINT target)
 {
@@ -124,7 +131,16 @@ VOID Trace(TRACE trace, VOID *v)
     {
         INS tail = BBL_InsTail(bbl);
         
-        if( INS_IsCall(tail) )
+        if( recorder.IsActive() )
+        {
+            RTN rtn = TRACE_Rtn(trace);
+            if( INS_IsCall(tail)
+                || (RTN_Valid(rtn) && !INS_IsDirectBranchOrCall(tail) && ".plt" == SEC_Name( RTN_Sec( rtn ) )) )
+            {
+                recorder.Insert(tail, FLIGHT_CALL, IARG_BRANCH_TARGET_ADDR);
+            }
+        }
+        else if( INS_IsCall(tail) )
         {
             if( INS_IsDirectBranchOrCall(tail) )
             {
@@ -184,8 +200,24 @@ VOID Trace(TRACE trace, VOID *v)
 
 /* ===================================================================== */
 
+VOID OnSig(THREADID tid, CONTEXT_CHANGE_REASON reason, const CONTEXT *from, CONTEXT *to, INT32 sig, VOID *v)
+{
+    if (reason == CONTEXT_CHANGE_REASON_FATALSIGNAL || reason == CONTEXT_CHANGE_REASON_EXCEPTION)
+    {
+        recorder.Dump(TraceFile, "signal " + decstr(sig) + " on thread " + decstr(tid), tid);
+    }
+}
+
+/* ===================================================================== */
+
 VOID Fini(INT32 code, VOID *v)
 {
+    if (recorder.IsActive())
+    {
+        recorder.Dump(TraceFile, "end of program");
+        recorder.Release();
+    }
+
     TraceFile << "# eof" << endl;
     
     TraceFile.close();
@@ -218,6 +250,12 @@ int  main(int argc, char *argv[])
 
     TraceFile.write(trace_header.c_str(),trace_header.size());
     
+    if (KnobFlightRecorder)
+    {
+        recorder.Activate(KnobFlightRecorder);
+        PIN_AddContextChangeFunction(OnSig, 0);
+    }
+
     TRACE_AddInstrumentFunction(Trace, 0);
     PIN_AddFiniFunction(Fini, 0);
 
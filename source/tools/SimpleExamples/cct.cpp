@@ -0,0 +1,470 @@
+/*BEGIN_LEGAL 
+Intel Open Source License 
+
+Copyright (c) 2002-2016 Intel Corporation. All rights reserved.
+ 
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are
+met:
+
+Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.  Redistributions
+in binary form must reproduce the above copyright notice, this list of
+conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.  Neither the name of
+the Intel Corporation nor the names of its contributors may be used to
+endorse or promote products derived from this software without
+specific prior written permission.
+ 
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE INTEL OR
+ITS CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+END_LEGAL */
+/*! @file
+ *  This file contains a calling context tree (CCT) profiler.
+ *
+ *  Each thread keeps its own tree and a cursor that follows the calls and
+ *  returns seen by the thread's stack in InstLib/call-stack.cpp. Every
+ *  node counts the instructions executed in its context and, with
+ *  -cache_misses, the DL1 misses of a simulated cache (see cache.H).
+ *
+ *  The trees are written in a compact binary form (-o), which cctfold.py
+ *  turns into folded stacks for flamegraph.pl. -folded writes the folded
+ *  stacks directly.
+ */
+
+#include "pin.H"
+#include "call-stack.H"
+#include "cache.H"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+
+using namespace CALLSTACK;
+
+/* ===================================================================== */
+/* Commandline Switches */
+/* ===================================================================== */
+
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "cct.out", "specify the binary tree file name");
+KNOB<string> KnobFoldedFile(KNOB_MODE_WRITEONCE, "pintool", "folded", "", "also write folded stacks to this file");
+KNOB<string> KnobFoldedMetric(KNOB_MODE_WRITEONCE, "pintool", "metric", "icount",
+                              "metric of the folded stacks: icount or misses");
+KNOB<BOOL>   KnobCacheMisses(KNOB_MODE_WRITEONCE, "pintool", "cache_misses", "0", "count DL1 misses per context");
+KNOB<UINT32> KnobCacheSize(KNOB_MODE_WRITEONCE, "pintool", "dl1-size", "32", "dcache size in kilobytes");
+KNOB<UINT32> KnobLineSize(KNOB_MODE_WRITEONCE, "pintool", "line-size", "64", "cache block size in bytes");
+KNOB<UINT32> KnobAssociativity(KNOB_MODE_WRITEONCE, "pintool", "a", "8", "cache associativity (1 for direct mapped)");
+
+/* ===================================================================== */
+/* Print Help Message                                                    */
+/* ===================================================================== */
+
+INT32 Usage()
+{
+    cerr << "This tool builds a calling context tree with instruction counts." << endl << endl;
+    cerr << KNOB_BASE::StringKnobSummary() << endl;
+    return -1;
+}
+
+/* ===================================================================== */
+/* Calling context tree */
+/* ===================================================================== */
+
+const char CCT_MAGIC[8] = { 'P', 'I', 'N', 'C', 'C', 'T', '0', '1' };
+
+// Nodes refer to each other by index into the arena of their thread
+const UINT32 NO_NODE = ~0U;
+
+struct CCT_NODE
+{
+    UINT64 icount;
+    UINT64 misses;
+    CallSiteId site;         // the function that was called to get here
+    UINT32 parent;
+    UINT32 first_child;
+    UINT32 next_sibling;
+};
+
+// Nodes are allocated in fixed size chunks, so a node never moves and the
+// analysis routines can keep a pointer to the current one.
+class CCT_ARENA
+{
+  public:
+    static const UINT32 CHUNK_BITS = 12;
+    static const UINT32 CHUNK_SIZE = 1 << CHUNK_BITS;
+
+    CCT_ARENA() : _size(0) {}
+
+    UINT32 Size() const { return _size; }
+    CCT_NODE * Get(UINT32 id) const { return &_chunks[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)]; }
+
+    UINT32 New(CallSiteId site, UINT32 parent)
+    {
+        if ((_size & (CHUNK_SIZE - 1)) == 0)
+            _chunks.push_back(new CCT_NODE[CHUNK_SIZE]);
+        UINT32 id = _size++;
+        CCT_NODE * node = Get(id);
+        node->icount = 0;
+        node->misses = 0;
+        node->site = site;
+        node->parent = parent;
+        node->first_child = NO_NODE;
+        node->next_sibling = NO_NODE;
+        return id;
+    }
+
+  private:
+    vector<CCT_NODE *> _chunks;
+    UINT32 _size;
+};
+
+class THREAD_CCT
+{
+  public:
+    CCT_NODE * cursor;      // the current context
+
+    THREAD_CCT(THREADID tid) : _tid(tid)
+    {
+        _cursorId = _arena.New(0, NO_NODE);
+        cursor = _arena.Get(_cursorId);
+    }
+
+    THREADID Tid() const { return _tid; }
+    const CCT_ARENA & Arena() const { return _arena; }
+
+    // CALL_STACK_PUSH_HANDLER and CALL_STACK_POP_HANDLER of the thread's
+    // CallStack, which decides when a call is entered or left
+    static VOID Call(CallSiteId site, VOID * v)
+    {
+        THREAD_CCT * t = static_cast<THREAD_CCT *>(v);
+        t->_cursorId = t->Child(t->_cursorId, site);
+        t->cursor = t->_arena.Get(t->_cursorId);
+    }
+
+    static VOID Return(VOID * v)
+    {
+        THREAD_CCT * t = static_cast<THREAD_CCT *>(v);
+        if (t->cursor->parent == NO_NODE)
+            return; // we did not see the call
+        t->_cursorId = t->cursor->parent;
+        t->cursor = t->_arena.Get(t->_cursorId);
+    }
+
+  private:
+    const THREADID _tid;
+    CCT_ARENA _arena;
+    UINT32 _cursorId;
+
+    // Find or add the child of parent for site. A found child is moved to
+    // the front of the list, so the hot callees are found first.
+    UINT32 Child(UINT32 parent, CallSiteId site)
+    {
+        CCT_NODE * p = _arena.Get(parent);
+        UINT32 prev = NO_NODE;
+        for (UINT32 c = p->first_child; c != NO_NODE; prev = c, c = _arena.Get(c)->next_sibling)
+        {
+            CCT_NODE * child = _arena.Get(c);
+            if (child->site != site)
+                continue;
+            if (prev != NO_NODE)
+            {
+                _arena.Get(prev)->next_sibling = child->next_sibling;
+                child->next_sibling = p->first_child;
+                p->first_child = c;
+            }
+            return c;
+        }
+        UINT32 c = _arena.New(site, parent);
+        CCT_NODE * child = _arena.Get(c);
+        p = _arena.Get(parent);
+        child->next_sibling = p->first_child;
+        p->first_child = c;
+        return c;
+    }
+};
+
+/* ===================================================================== */
+/* Global Variables */
+/* ===================================================================== */
+
+REG cctReg;
+PIN_LOCK threadsLock;
+vector<THREAD_CCT *> threads; // in the order they started
+
+namespace DCACHE
+{
+    const UINT32 max_sets = KILO;
+    const UINT32 max_associativity = 256;
+    const CACHE_ALLOC::STORE_ALLOCATION allocation = CACHE_ALLOC::STORE_ALLOCATE;
+
+    typedef CACHE_ROUND_ROBIN(max_sets, max_associativity, allocation) DCACHE;
+}
+
+DCACHE::DCACHE * dl1 = NULL;
+PIN_LOCK cacheLock;  // the cache is shared by all threads
+
+/* ===================================================================== */
+/* Analysis routines                                                     */
+/* ===================================================================== */
+
+VOID PIN_FAST_ANALYSIS_CALL CountBlock(THREAD_CCT * t, UINT32 numIns)
+{
+    t->cursor->icount += numIns;
+}
+
+VOID MemoryAccess(THREAD_CCT * t, ADDRINT addr, UINT32 size, UINT32 type, THREADID tid)
+{
+    PIN_GetLock(&cacheLock, tid + 1);
+    const BOOL hit = dl1->Access(addr, size, CACHE_BASE::ACCESS_TYPE(type), TRUE);
+    PIN_ReleaseLock(&cacheLock);
+    if (!hit)
+        t->cursor->misses++;
+}
+
+/* ===================================================================== */
+/* Instrumentation routines                                              */
+/* ===================================================================== */
+
+VOID Trace(TRACE trace, VOID * v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        // Count the block before a call at its head moves the cursor
+        BBL_InsertCall(bbl, IPOINT_BEFORE, AFUNPTR(CountBlock), IARG_FAST_ANALYSIS_CALL,
+                       IARG_CALL_ORDER, CALL_ORDER_FIRST,
+                       IARG_REG_VALUE, cctReg, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+
+        if (KnobCacheMisses)
+        {
+            for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+            {
+                if (!INS_IsStandardMemop(ins))
+                    continue;
+                if (INS_IsMemoryRead(ins))
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, AFUNPTR(MemoryAccess),
+                                             IARG_REG_VALUE, cctReg,
+                                             IARG_MEMORYREAD_EA, IARG_MEMORYREAD_SIZE,
+                                             IARG_UINT32, UINT32(CACHE_BASE::ACCESS_TYPE_LOAD),
+                                             IARG_THREAD_ID, IARG_END);
+                if (INS_IsMemoryWrite(ins))
+                    INS_InsertPredicatedCall(ins, IPOINT_BEFORE, AFUNPTR(MemoryAccess),
+                                             IARG_REG_VALUE, cctReg,
+                                             IARG_MEMORYWRITE_EA, IARG_MEMORYWRITE_SIZE,
+                                             IARG_UINT32, UINT32(CACHE_BASE::ACCESS_TYPE_STORE),
+                                             IARG_THREAD_ID, IARG_END);
+            }
+        }
+    }
+}
+
+VOID ThreadStart(THREADID tid, CONTEXT * ctxt, INT32 flags, VOID * v)
+{
+    THREAD_CCT * t = new THREAD_CCT(tid);
+
+    PIN_GetLock(&threadsLock, tid + 1);
+    threads.push_back(t);
+    PIN_ReleaseLock(&threadsLock);
+
+    PIN_SetContextReg(ctxt, cctReg, reinterpret_cast<ADDRINT>(t));
+    CallStackManager::get_instance()->stack(tid)->set_call_handlers(THREAD_CCT::Call, THREAD_CCT::Return, t);
+}
+
+/* ===================================================================== */
+/* Output                                                                */
+/* ===================================================================== */
+
+// The name of a frame in the folded stacks
+string FrameName(CallSiteId site)
+{
+    const CallStackInfo & info = CallStackManager::get_instance()->site_info(site);
+    string name = info.func_name;
+    if (name == "")
+        name = hexstr(CallStackManager::get_instance()->site_address(site));
+    for (string::iterator it = name.begin(); it != name.end(); it++)
+    {
+        if (*it == ';')
+            *it = ':';
+    }
+    return name;
+}
+
+// Node ids in preorder, so that every parent is written before its children
+VOID Preorder(const CCT_ARENA & arena, vector<UINT32> & order)
+{
+    order.clear();
+    vector<UINT32> pending(1, 0);
+    while (!pending.empty())
+    {
+        UINT32 id = pending.back();
+        pending.pop_back();
+        order.push_back(id);
+        for (UINT32 c = arena.Get(id)->first_child; c != NO_NODE; c = arena.Get(c)->next_sibling)
+            pending.push_back(c);
+    }
+}
+
+template <typename T> VOID Put(ofstream & out, T value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+VOID PutString(ofstream & out, const string & s)
+{
+    Put<UINT32>(out, s.size());
+    out.write(s.c_str(), s.size());
+}
+
+// The tree file:
+//   magic, UINT32 num_sites, num_sites x { UINT32 id, UINT64 address, name, image },
+//   UINT32 num_threads, num_threads x { UINT32 tid, UINT32 num_nodes,
+//   num_nodes x { UINT32 site, UINT32 parent, UINT64 icount, UINT64 misses } }
+// Strings are a UINT32 length followed by the bytes. Nodes are in preorder
+// and parent is the index of the parent node in the thread (~0 for the root).
+VOID WriteTree(const string & filename)
+{
+    ofstream out(filename.c_str(), ios::out | ios::binary);
+    vector<UINT32> order;
+
+    map<CallSiteId, BOOL> sites;
+    for (vector<THREAD_CCT *>::iterator t = threads.begin(); t != threads.end(); t++)
+    {
+        const CCT_ARENA & arena = (*t)->Arena();
+        for (UINT32 i = 1; i < arena.Size(); i++)
+            sites[arena.Get(i)->site] = TRUE;
+    }
+
+    out.write(CCT_MAGIC, sizeof(CCT_MAGIC));
+    Put<UINT32>(out, sites.size());
+    for (map<CallSiteId, BOOL>::iterator s = sites.begin(); s != sites.end(); s++)
+    {
+        Put<UINT32>(out, s->first);
+        Put<UINT64>(out, CallStackManager::get_instance()->site_address(s->first));
+        PutString(out, FrameName(s->first));
+        PutString(out, CallStackManager::get_instance()->site_info(s->first).image_name);
+    }
+
+    Put<UINT32>(out, threads.size());
+    for (vector<THREAD_CCT *>::iterator t = threads.begin(); t != threads.end(); t++)
+    {
+        const CCT_ARENA & arena = (*t)->Arena();
+        Preorder(arena, order);
+        vector<UINT32> index(arena.Size());
+        for (UINT32 i = 0; i < order.size(); i++)
+            index[order[i]] = i;
+
+        Put<UINT32>(out, (*t)->Tid());
+        Put<UINT32>(out, order.size());
+        for (UINT32 i = 0; i < order.size(); i++)
+        {
+            const CCT_NODE * node = arena.Get(order[i]);
+            Put<UINT32>(out, node->site);
+            Put<UINT32>(out, node->parent == NO_NODE ? NO_NODE : index[node->parent]);
+            Put<UINT64>(out, node->icount);
+            Put<UINT64>(out, node->misses);
+        }
+    }
+}
+
+// One line per context: the frames from the outermost call, separated by
+// ';', and the count of the context itself. Contexts that are the same in
+// several threads are added up.
+VOID WriteFolded(const string & filename, BOOL misses)
+{
+    map<string, UINT64> folded;
+    map<CallSiteId, string> names;
+    vector<UINT32> order;
+
+    for (vector<THREAD_CCT *>::iterator t = threads.begin(); t != threads.end(); t++)
+    {
+        const CCT_ARENA & arena = (*t)->Arena();
+        Preorder(arena, order);
+        vector<string> paths(arena.Size());
+        for (UINT32 i = 0; i < order.size(); i++)
+        {
+            const UINT32 id = order[i];
+            const CCT_NODE * node = arena.Get(id);
+            if (node->parent == NO_NODE)
+            {
+                paths[id] = "[root]";
+            }
+            else
+            {
+                map<CallSiteId, string>::iterator n = names.find(node->site);
+                if (n == names.end())
+                    n = names.insert(make_pair(node->site, FrameName(node->site))).first;
+                const CCT_NODE * parent = arena.Get(node->parent);
+                paths[id] = (parent->parent == NO_NODE) ? n->second : paths[node->parent] + ";" + n->second;
+            }
+            const UINT64 count = misses ? node->misses : node->icount;
+            if (count)
+                folded[paths[id]] += count;
+        }
+    }
+
+    ofstream out(filename.c_str());
+    for (map<string, UINT64>::iterator f = folded.begin(); f != folded.end(); f++)
+        out << f->first << " " << dec << f->second << "\n";
+}
+
+VOID Fini(INT32 code, VOID * v)
+{
+    WriteTree(KnobOutputFile.Value());
+    if (!KnobFoldedFile.Value().empty())
+        WriteFolded(KnobFoldedFile.Value(), KnobFoldedMetric.Value() == "misses");
+}
+
+/* ===================================================================== */
+/* Main                                                                  */
+/* ===================================================================== */
+
+int main(int argc, char * argv[])
+{
+    PIN_InitSymbols();
+
+    if (PIN_Init(argc, argv))
+        return Usage();
+
+    if (KnobFoldedMetric.Value() != "icount" && KnobFoldedMetric.Value() != "misses")
+        return Usage();
+
+    cctReg = PIN_ClaimToolRegister();
+    if (!REG_valid(cctReg))
+    {
+        cerr << "cct: cannot allocate a scratch register" << endl;
+        return 1;
+    }
+    PIN_InitLock(&threadsLock);
+    PIN_InitLock(&cacheLock);
+
+    if (KnobCacheMisses)
+    {
+        dl1 = new DCACHE::DCACHE("L1 Data Cache",
+                                 KnobCacheSize.Value() * KILO,
+                                 KnobLineSize.Value(),
+                                 KnobAssociativity.Value());
+    }
+
+    // The call stacks must exist before ThreadStart hooks the tree on them
+    CallStackManager::get_instance()->activate();
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    TRACE_AddInstrumentFunction(Trace, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    // Never returns
+    PIN_StartProgram();
+
+    return 0;
+}
+
+/* ===================================================================== */
+/* eof */
+/* ===================================================================== */
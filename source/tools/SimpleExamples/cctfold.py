@@ -0,0 +1,112 @@
+#!/usr/bin/env python
+#
+# Turn the calling context tree written by cct (cct -o <file>) into folded
+# stacks, one line per context:
+#
+#     main;foo;bar 1234
+#
+# which is the input format of flamegraph.pl. The output is the same as
+# the one cct writes with -folded.
+#
+# Usage: cctfold.py [-m icount|misses] [-t] <cct.out>
+#   -m  the metric to fold (default icount)
+#   -t  keep the threads apart, with a "thread N" frame at the bottom
+
+from __future__ import print_function
+
+import optparse
+import struct
+import sys
+
+MAGIC = b'PINCCT01'
+NO_NODE = 0xffffffff
+NODE = struct.Struct('=IIQQ')
+
+
+class Reader(object):
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def take(self, fmt):
+        values = struct.unpack_from(fmt, self.data, self.pos)
+        self.pos += struct.calcsize(fmt)
+        return values
+
+    def string(self):
+        (length,) = self.take('=I')
+        s = self.data[self.pos:self.pos + length]
+        self.pos += length
+        return s
+
+
+def read_tree(filename):
+    '''Return ({site: name}, [(tid, [(site, parent, icount, misses)])]).'''
+    f = open(filename, 'rb')
+    try:
+        r = Reader(f.read())
+    finally:
+        f.close()
+    if r.data[:len(MAGIC)] != MAGIC:
+        raise ValueError('%s is not a cct file' % filename)
+    r.pos = len(MAGIC)
+
+    names = {}
+    (num_sites,) = r.take('=I')
+    for _ in range(num_sites):
+        site, address = r.take('=IQ')
+        names[site] = r.string()
+        r.string()  # image
+
+    threads = []
+    (num_threads,) = r.take('=I')
+    for _ in range(num_threads):
+        tid, num_nodes = r.take('=II')
+        nodes = []
+        for _ in range(num_nodes):
+            nodes.append(NODE.unpack_from(r.data, r.pos))
+            r.pos += NODE.size
+        threads.append((tid, nodes))
+    return names, threads
+
+
+def fold(names, threads, metric, per_thread):
+    folded = {}
+    for tid, nodes in threads:
+        paths = []
+        for site, parent, icount, misses in nodes:
+            if parent == NO_NODE:
+                path = b'[root]'
+            elif nodes[parent][1] == NO_NODE:
+                path = names[site]
+            else:
+                path = paths[parent] + b';' + names[site]
+            paths.append(path)
+            count = misses if metric == 'misses' else icount
+            if count:
+                if per_thread:
+                    path = ('thread %d;' % tid).encode('ascii') + path
+                folded[path] = folded.get(path, 0) + count
+    return folded
+
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] <cct file>')
+    parser.add_option('-m', '--metric', choices=['icount', 'misses'],
+                      default='icount', help='icount or misses')
+    parser.add_option('-t', '--threads', action='store_true', default=False,
+                      help='keep the threads apart')
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error('expected one cct file')
+
+    names, threads = read_tree(args[0])
+    folded = fold(names, threads, options.metric, options.threads)
+    out = getattr(sys.stdout, 'buffer', sys.stdout)
+    for path in sorted(folded):
+        out.write(path + (' %d\n' % folded[path]).encode('ascii'))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
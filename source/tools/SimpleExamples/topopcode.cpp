@@ -41,6 +41,9 @@ END_LEGAL */
 #include <algorithm> // for sort
 #include <vector>
 #include "pin.H"
+#include "stats_segment.H"
+
+using namespace INSTLIB;
 
 /* ===================================================================== */
 /* Commandline Switches */
@@ -64,6 +67,10 @@ KNOB<UINT64>   KnobDetachUpdates(KNOB_MODE_WRITEONCE,  "pintool",
 KNOB<FLT64>   KnobDecayFactor(KNOB_MODE_WRITEONCE,  "pintool",
                           "f", "0.0", "x");
 
+KNOB<string>  KnobStatsFile(KNOB_MODE_WRITEONCE,  "pintool",
+                          "stats_file", "", "instead of printing the histogram, publish the counts "
+                          "in this memory mapped file (see InstLib/statsview.py)");
+
 /* ===================================================================== */
 /* Print Help Message                                                    */
 /* ===================================================================== */
@@ -231,6 +238,7 @@ class STATS
 };
 
 STATS GlobalStats;
+STATS LiveStats;  // never decays, published to the -stats_file
 
 class BBLSTATS
 {
@@ -263,28 +271,73 @@ LOCALFUN BOOL CompareLess(PAIR  s1 , PAIR  s2)
 }
 
 /* ===================================================================== */
-VOID DumpHistogram(std::ostream& out)
+VOID FoldCounters()
 {
-    const UINT64 cutoff = KnobCutoff.Value();
-    const UINT64 maxlines = KnobMaxLines.Value();
-
-    out << "\033[0;0H";
-    out << "\033[2J";
-    out << "\033[44m";
-    out << ljstr("OPCODE",15) << " " << setw(16) << "COUNT";
-    out << "\033[0m";
-    out << endl;
-
     for (vector<BBLSTATS*>::iterator bi = statsList.begin(); bi != statsList.end(); bi++)
     {
         BBLSTATS *b = (*bi);
+        if (b->_counter == 0) continue;
 
         for (const UINT16 * stats = b->_stats; *stats; stats++)
         {
             GlobalStats.unpredicated[*stats] += b->_counter;
+            LiveStats.unpredicated[*stats] += b->_counter;
         }
         b->_counter = 0;
     }
+}
+
+/* ===================================================================== */
+/* Live stats */
+/* ===================================================================== */
+
+LOCALVAR STATS_SEGMENT statsSegment;
+LOCALVAR vector<UINT32> statsSegmentIndex; // segment counter -> stat index
+LOCALVAR vector<UINT64> statsSegmentCounts;
+
+LOCALFUN BOOL OpenStatsSegment()
+{
+    vector<string> names;
+    statsSegmentIndex.push_back(INDEX_TOTAL);
+    names.push_back(IndexToOpcodeString(INDEX_TOTAL));
+    for (UINT32 i = 1; i < XED_ICLASS_LAST; i++)
+    {
+        statsSegmentIndex.push_back(i);
+        names.push_back(IndexToOpcodeString(i));
+    }
+    for (UINT32 i = INDEX_TOTAL + 1; i < INDEX_SPECIAL_END; i++)
+    {
+        statsSegmentIndex.push_back(i);
+        names.push_back(IndexToOpcodeString(i));
+    }
+    statsSegmentCounts.resize(names.size());
+    return statsSegment.Open(KnobStatsFile.Value(), 1, names);
+}
+
+LOCALFUN VOID PublishStats()
+{
+    COUNTER total = 0;
+    for (UINT32 i = 0; i < INDEX_SPECIAL; i++)
+        total += LiveStats.unpredicated[i];
+    LiveStats.unpredicated[INDEX_TOTAL] = total;
+
+    for (UINT32 c = 0; c < statsSegmentIndex.size(); c++)
+        statsSegmentCounts[c] = LiveStats.unpredicated[statsSegmentIndex[c]];
+    statsSegment.Publish(0, 0, &statsSegmentCounts[0]);
+}
+
+/* ===================================================================== */
+VOID DumpHistogram(std::ostream& out)
+{
+    const UINT64 cutoff = KnobCutoff.Value();
+    const UINT64 maxlines = KnobMaxLines.Value();
+
+    out << "\033[0;0H";
+    out << "\033[2J";
+    out << "\033[44m";
+    out << ljstr("OPCODE",15) << " " << setw(16) << "COUNT";
+    out << "\033[0m";
+    out << endl;
 
     COUNTER total = 0;
     VEC CountMap;
@@ -340,8 +393,16 @@ VOID docount(COUNTER * counter)
 #endif
 #endif
 
-        DumpHistogram(Out);
-        Out << flush;
+        FoldCounters();
+        if (statsSegment.Valid())
+        {
+            PublishStats();
+        }
+        else
+        {
+            DumpHistogram(Out);
+            Out << flush;
+        }
 
         FLT64 factor = KnobDecayFactor.Value();
         GlobalStats.Clear(factor);
@@ -410,6 +471,12 @@ VOID Trace(TRACE trace, VOID *v)
     }
 }
 
+VOID Fini(INT32 code, VOID *v)
+{
+    FoldCounters();
+    PublishStats();
+}
+
 /* ===================================================================== */
 /* Main                                                                  */
 /* ===================================================================== */
@@ -423,6 +490,14 @@ int main(int argc, CHAR *argv[])
         return Usage();
     }
 
+    if (!KnobStatsFile.Value().empty() && !OpenStatsSegment())
+    {
+        cerr << "topopcode: cannot create stats file " << KnobStatsFile.Value() << endl;
+        return 1;
+    }
+    if (statsSegment.Valid())
+        PIN_AddFiniFunction(Fini, 0);
+
     Out.open(KnobOutputFile.Value().c_str());
     TRACE_AddInstrumentFunction(Trace, 0);
 